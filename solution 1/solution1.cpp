@@ -67,14 +67,41 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <filesystem>
+#include <sstream>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <limits>
 #include <pqxx/pqxx>
 
+#include "../solution 3/hilbert_key.h"
+#include "../solution 3/parse_count.h"
+#include "../solution 3/region_snapshot.h"
+
 namespace fs = std::filesystem;
 
+// How inspection_region is split into partitions
+struct PartitionOptions {
+    std::string scheme = "none";   // "none", "tiles" (range on coord_y) or "group_hash" (hash of group_id)
+    size_t count = 8;              // partitions, and connections loading the regions (up to the hardware threads)
+    bool repartition = false;      // drop and rebuild an inspection_region that already holds rows
+};
+
+// Indexes built after the load, and the VACUUM making them usable for index-only scans
+struct IndexOptions {
+    std::vector<int> hot_categories;   // each gets a partial crop index WHERE category = c
+    bool vacuum = true;                // VACUUM (ANALYZE) inspection_region once the indexes exist
+};
+
 class DataLoader {
 public:
-    DataLoader(const std::string& conn_str) : connection_string_(conn_str) {}
+    DataLoader(const std::string& conn_str, const std::string& snapshot_file = "",
+               const PartitionOptions& partitions = PartitionOptions(), bool cluster = false,
+               const IndexOptions& indexes = IndexOptions())
+        : connection_string_(conn_str), snapshot_file_(snapshot_file), partitions_(partitions), cluster_(cluster),
+          indexes_(indexes) {}
 
     bool loadData(const std::string& data_directory) {
         try {
@@ -91,7 +118,15 @@ public:
             }
 
             // Connect to database and load data
-            return insertIntoDatabase(points, categories, groups);
+            if (!insertIntoDatabase(points, categories, groups)) {
+                return false;
+            }
+
+            // Snapshot of the same rows for the in-memory query engine
+            if (!snapshot_file_.empty()) {
+                writeSnapshot(points, categories, groups);
+            }
+            return true;
 
         } catch (const std::exception& e) {
             std::cerr << "Error loading data: " << e.what() << std::endl;
@@ -101,6 +136,42 @@ public:
 
 private:
     std::string connection_string_;
+    std::string snapshot_file_;
+    PartitionOptions partitions_;
+    std::vector<double> band_edges_;   // inner coord_y edges of the "tiles" bands
+
+    // With cluster_, rows carry a Hilbert key over the data's extent and are
+    // inserted in key order, so the heap is clustered in space
+    bool cluster_;
+    HilbertKey curve_;
+    std::vector<uint64_t> keys_;
+    std::vector<size_t> order_;   // insertion order of the lines
+
+    IndexOptions indexes_;
+
+    // Region ids match the database rows: line number, 1-based. Rows are
+    // stored in (y, x) order so in-memory results come out sorted.
+    void writeSnapshot(const std::vector<std::pair<double, double>>& points,
+                       const std::vector<int>& categories,
+                       const std::vector<long>& groups) {
+        std::vector<size_t> order(points.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        std::sort(order.begin(), order.end(), [&points](size_t a, size_t b) {
+            if (points[a].second != points[b].second) return points[a].second < points[b].second;
+            if (points[a].first != points[b].first) return points[a].first < points[b].first;
+            return a < b;
+        });
+
+        RegionStore store;
+        store.reserve(points.size());
+        for (size_t i : order) {
+            store.append(i + 1, groups[i], points[i].first, points[i].second, categories[i]);
+        }
+        KdTree index(store);
+        PostingsIndex postings(store);
+        RegionSnapshot::write(snapshot_file_, store, &index, &postings);
+        std::cout << "Snapshot written to: " << snapshot_file_ << std::endl;
+    }
 
     std::vector<std::pair<double, double>> readPointsFile(const std::string& filename) {
         std::vector<std::pair<double, double>> points;
@@ -171,43 +242,176 @@ private:
 
             pqxx::work txn(conn);
 
+            order_.resize(points.size());
+            for (size_t i = 0; i < order_.size(); ++i) order_[i] = i;
+            if (cluster_) {
+                computeKeys(points);
+            }
+
             // First, ensure tables exist by executing the schema
-            createTables(txn);
-
-            // Insert data - line i in all files corresponds to the same region
-            for (size_t i = 0; i < points.size(); ++i) {
-                // Use line number (1-based) as the region ID
-                long region_id = i + 1;
-                long group_id = groups[i];
-                double coord_x = points[i].first;
-                double coord_y = points[i].second;
-                int category = categories[i];
-
-                // First ensure the group exists
+            createTables(txn, points);
+
+            if (partitions_.scheme == "none") {
+                insertRegions(txn, points, categories, groups, 0, points.size(), true);
+
+                // Built after the rows are in, which is cheaper than maintaining it per insert
+                createIndexes(txn);
+                txn.commit();
+            } else {
+                // Groups first, so the parallel region loads do not contend on
+                // them, in one statement over a bigint[] of the distinct ids
+                std::vector<long> group_ids(groups);
+                std::sort(group_ids.begin(), group_ids.end());
+                group_ids.erase(std::unique(group_ids.begin(), group_ids.end()), group_ids.end());
+                std::string array = "{";
+                for (size_t g = 0; g < group_ids.size(); ++g) {
+                    if (g > 0) array += ",";
+                    array += std::to_string(group_ids[g]);
+                }
+                txn.exec_params("INSERT INTO inspection_group (id) SELECT unnest($1::bigint[]) ON CONFLICT (id) DO NOTHING",
+                                array + "}");
+                txn.commit();
+                insertRegionsInParallel(points, categories, groups);
+
+                pqxx::work index_txn(conn);
+                createIndexes(index_txn);
+                index_txn.commit();
+            }
+
+            // Freshly inserted pages are not yet all-visible, so until a vacuum
+            // sets the visibility map every index-only scan still visits the heap
+            if (indexes_.vacuum) {
+                pqxx::nontransaction vacuum_txn(conn);
+                vacuum_txn.exec("VACUUM (ANALYZE) inspection_region");
+                std::cout << "Vacuumed and analyzed inspection_region" << std::endl;
+            }
+            std::cout << "Successfully loaded " << points.size() << " regions into database" << std::endl;
+            return true;
+
+        } catch (const std::exception& e) {
+            std::cerr << "Database error: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Hilbert key of every line and the lines sorted by key
+    void computeKeys(const std::vector<std::pair<double, double>>& points) {
+        if (points.empty()) return;
+        double min_x = points[0].first, max_x = points[0].first;
+        double min_y = points[0].second, max_y = points[0].second;
+        for (const auto& point : points) {
+            min_x = std::min(min_x, point.first);
+            max_x = std::max(max_x, point.first);
+            min_y = std::min(min_y, point.second);
+            max_y = std::max(max_y, point.second);
+        }
+        curve_ = HilbertKey(min_x, min_y, max_x, max_y);
+        keys_.resize(points.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+            keys_[i] = curve_.key(points[i].first, points[i].second);
+        }
+        std::stable_sort(order_.begin(), order_.end(), [this](size_t a, size_t b) { return keys_[a] < keys_[b]; });
+    }
+
+    // Inserts the lines order_[begin, end); line i in all files is region
+    // i + 1. Groups are inserted with their regions unless with_groups is false.
+    void insertRegions(pqxx::work& txn,
+                       const std::vector<std::pair<double, double>>& points,
+                       const std::vector<int>& categories,
+                       const std::vector<long>& groups,
+                       size_t begin, size_t end, bool with_groups) {
+        for (size_t n = begin; n < end; ++n) {
+            size_t i = order_[n];
+            // Use line number (1-based) as the region ID
+            long region_id = i + 1;
+            long group_id = groups[i];
+            double coord_x = points[i].first;
+            double coord_y = points[i].second;
+            int category = categories[i];
+
+            // First ensure the group exists
+            if (with_groups) {
                 txn.exec_params(
                     "INSERT INTO inspection_group (id) VALUES ($1) ON CONFLICT (id) DO NOTHING",
                     group_id
                 );
+            }
 
-                // Then insert the region
+            // Then insert the region. A partitioned table's key includes the
+            // partition column, so the conflict target is left implicit.
+            if (cluster_) {
+                txn.exec_params(
+                    "INSERT INTO inspection_region (id, group_id, coord_x, coord_y, category, spatial_key) "
+                    "VALUES ($1, $2, $3, $4, $5, $6) ON CONFLICT DO NOTHING",
+                    region_id, group_id, coord_x, coord_y, category, static_cast<long>(keys_[i])
+                );
+            } else {
                 txn.exec_params(
                     "INSERT INTO inspection_region (id, group_id, coord_x, coord_y, category) "
-                    "VALUES ($1, $2, $3, $4, $5) ON CONFLICT (id) DO NOTHING",
+                    "VALUES ($1, $2, $3, $4, $5) ON CONFLICT DO NOTHING",
                     region_id, group_id, coord_x, coord_y, category
                 );
             }
+        }
+    }
 
-            txn.commit();
-            std::cout << "Successfully loaded " << points.size() << " regions into database" << std::endl;
-            return true;
+    // One worker per partition (up to the hardware threads), each inserting a
+    // contiguous share of the rows on its own connection and transaction; the
+    // server routes every row to its partition. With cluster_, concurrent
+    // workers would interleave their key ranges in each partition's heap, so
+    // every band goes to a single worker in key order; hash partitions cannot
+    // be told apart here and are loaded on one connection.
+    void insertRegionsInParallel(const std::vector<std::pair<double, double>>& points,
+                                 const std::vector<int>& categories,
+                                 const std::vector<long>& groups) {
+        size_t hardware = std::max<size_t>(1, std::thread::hardware_concurrency());
+        size_t workers = std::max<size_t>(1, std::min({partitions_.count, hardware, points.size()}));
+        std::vector<size_t> starts(workers + 1);
+        for (size_t w = 0; w <= workers; ++w) starts[w] = points.size() * w / workers;
+
+        if (cluster_ && partitions_.scheme != "tiles") {
+            workers = 1;
+            starts = {0, points.size()};
+        } else if (cluster_) {
+            // Regroup order_ by band, keeping key order within each band, and
+            // give every worker whole bands
+            auto band = [&](size_t i) {
+                return static_cast<size_t>(std::upper_bound(band_edges_.begin(), band_edges_.end(), points[i].second) -
+                                           band_edges_.begin());
+            };
+            std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b) { return band(a) < band(b); });
+            size_t bands = band_edges_.size() + 1;
+            workers = std::min(workers, bands);
+            starts.assign(workers + 1, points.size());
+            starts[0] = 0;
+            size_t w = 1;
+            for (size_t n = 0; n < order_.size() && w < workers; ++n) {
+                while (w < workers && band(order_[n]) >= bands * w / workers) starts[w++] = n;
+            }
+        }
 
-        } catch (const std::exception& e) {
-            std::cerr << "Database error: " << e.what() << std::endl;
-            return false;
+        std::vector<std::exception_ptr> errors(workers);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers; ++w) {
+            threads.emplace_back([&, w]() {
+                try {
+                    pqxx::connection conn(connection_string_);
+                    pqxx::work txn(conn);
+                    insertRegions(txn, points, categories, groups, starts[w], starts[w + 1], false);
+                    txn.commit();
+                } catch (...) {
+                    errors[w] = std::current_exception();
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
         }
+        std::cout << "Loaded regions on " << workers << " connections" << std::endl;
     }
 
-    void createTables(pqxx::work& txn) {
+    void createTables(pqxx::work& txn, const std::vector<std::pair<double, double>>& points) {
         // Execute the provided schema exactly
         txn.exec(
             "CREATE TABLE IF NOT EXISTS inspection_group ("
@@ -215,34 +419,221 @@ private:
             "    PRIMARY KEY (id))"
         );
 
+        if (partitions_.scheme != "none") {
+            createPartitionedRegionTable(txn, points);
+        } else {
+            txn.exec(
+                "CREATE TABLE IF NOT EXISTS inspection_region ("
+                "    id BIGINT NOT NULL,"
+                "    group_id BIGINT,"
+                "    PRIMARY KEY (id))"
+            );
+
+            txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS coord_x FLOAT");
+            txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS coord_y FLOAT");
+            txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS category INTEGER");
+        }
+
+        // The query programs read the curve's extent to turn crops into key ranges.
+        // Rows already in the table would keep no key, or one on another curve,
+        // and crops would miss them, so clustering needs an empty table; a load
+        // without it drops the curve, so queries stop filtering on the keys.
+        if (cluster_) {
+            if (txn.exec("SELECT EXISTS (SELECT 1 FROM inspection_region)")[0][0].as<bool>()) {
+                throw std::runtime_error("--cluster hilbert needs an empty inspection_region; drop the table, "
+                                         "or rebuild it with --partition and --repartition");
+            }
+            txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS spatial_key BIGINT");
+            txn.exec(
+                "CREATE TABLE IF NOT EXISTS inspection_region_curve ("
+                "    min_x FLOAT NOT NULL,"
+                "    min_y FLOAT NOT NULL,"
+                "    max_x FLOAT NOT NULL,"
+                "    max_y FLOAT NOT NULL)"
+            );
+            txn.exec("DELETE FROM inspection_region_curve");
+            txn.exec_params("INSERT INTO inspection_region_curve (min_x, min_y, max_x, max_y) VALUES ($1, $2, $3, $4)",
+                            curve_.minX(), curve_.minY(), curve_.maxX(), curve_.maxY());
+        } else {
+            txn.exec("DROP TABLE IF EXISTS inspection_region_curve");
+        }
+        
+        std::cout << "Database tables created/verified" << std::endl;
+    }
+
+    // inspection_region split into partitions_.count partitions. "tiles" are
+    // bands of coord_y holding about the same number of rows each, so the
+    // coord_y bounds of every crop prune the bands it cannot touch; the band
+    // edges come from the data being loaded. "group_hash" spreads groups
+    // evenly, and keeps each group in one partition, so one_of_groups filters
+    // prune and the proper-group aggregation can run per partition
+    // (enable_partitionwise_aggregate). Indexes created on the parent table
+    // are created on every partition.
+    void createPartitionedRegionTable(pqxx::work& txn, const std::vector<std::pair<double, double>>& points) {
+        size_t count = std::max<size_t>(1, partitions_.count);
+        bool tiles = partitions_.scheme == "tiles";
+        band_edges_.clear();
+
+        // The layout depends on the scheme, the count and (for tiles) the data,
+        // so a table left by an earlier load, partitioned or not, is rebuilt
+        // instead of reused. Rows already in it are only dropped on request,
+        // and views depending on it make the DROP fail rather than vanish.
+        if (!txn.exec("SELECT to_regclass('inspection_region')")[0][0].is_null()) {
+            bool empty = txn.exec("SELECT NOT EXISTS (SELECT 1 FROM inspection_region)")[0][0].as<bool>();
+            if (!empty && !partitions_.repartition) {
+                throw std::runtime_error("inspection_region already holds rows; pass --repartition to drop them "
+                                         "and rebuild the table with the requested partitions");
+            }
+            txn.exec("DROP TABLE inspection_region");
+        }
+
+        // PostgreSQL requires the partition column in every unique constraint,
+        // so the key is (id, coord_y) or (id, group_id) rather than schema.pgsql's
+        // (id). Ids stay unique because they are line numbers of one load.
         txn.exec(
-            "CREATE TABLE IF NOT EXISTS inspection_region ("
+            "CREATE TABLE inspection_region ("
             "    id BIGINT NOT NULL,"
-            "    group_id BIGINT,"
-            "    PRIMARY KEY (id))"
+            "    group_id BIGINT NOT NULL,"
+            "    coord_x FLOAT,"
+            "    coord_y FLOAT NOT NULL,"
+            "    category INTEGER,"
+            + std::string(tiles ? "    PRIMARY KEY (id, coord_y)) PARTITION BY RANGE (coord_y)"
+                                : "    PRIMARY KEY (id, group_id)) PARTITION BY HASH (group_id)")
         );
 
-        txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS coord_x FLOAT");
-        txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS coord_y FLOAT");
-        txn.exec("ALTER TABLE inspection_region ADD COLUMN IF NOT EXISTS category INTEGER");
-        
-        std::cout << "Database tables created/verified" << std::endl;
+        std::vector<std::string> bounds;
+        if (tiles) {
+            // Band edges at the row-count quantiles of y; repeated values merge bands
+            std::vector<double> ys;
+            for (const auto& point : points) ys.push_back(point.second);
+            std::sort(ys.begin(), ys.end());
+            std::vector<std::string> edges = {"MINVALUE"};
+            double last = 0.0;
+            for (size_t p = 1; p < count && !ys.empty(); ++p) {
+                double edge = ys[ys.size() * p / count];
+                if (edges.size() > 1 && edge == last) continue;
+                std::ostringstream text;
+                text.precision(17);
+                text << edge;
+                edges.push_back(text.str());
+                band_edges_.push_back(edge);
+                last = edge;
+            }
+            edges.push_back("MAXVALUE");
+            for (size_t p = 0; p + 1 < edges.size(); ++p) {
+                bounds.push_back("FOR VALUES FROM (" + edges[p] + ") TO (" + edges[p + 1] + ")");
+            }
+        } else {
+            for (size_t p = 0; p < count; ++p) {
+                bounds.push_back("FOR VALUES WITH (MODULUS " + std::to_string(count) + ", REMAINDER " + std::to_string(p) + ")");
+            }
+        }
+
+        for (size_t p = 0; p < bounds.size(); ++p) {
+            txn.exec("CREATE TABLE inspection_region_p" + std::to_string(p) +
+                     " PARTITION OF inspection_region " + bounds[p]);
+        }
+        std::cout << "Partitioned inspection_region into " << bounds.size()
+                  << (tiles ? " coord_y bands" : " group_id hash partitions") << std::endl;
+    }
+
+    void createIndexes(pqxx::work& txn) {
+        // Results are returned in (y, x) order, so a paged query (ORDER BY
+        // coord_y, coord_x, id ... LIMIT) reads this index and stops after the
+        // page. It also carries the rest of the crop's select list, so crops are
+        // answered by index-only scans. It supersedes inspection_region_yx, the
+        // plain (coord_y, coord_x, id) index paging was first built on: the key
+        // order is the same, so the paged plan is unchanged and skips the heap.
+        txn.exec("CREATE INDEX IF NOT EXISTS inspection_region_yx_covering ON inspection_region "
+                 "(coord_y, coord_x, id) INCLUDE (group_id, category)");
+        txn.exec("DROP INDEX IF EXISTS inspection_region_yx");
+
+        // The proper-points join aggregates every group's coordinates and
+        // one_of_groups filters look groups up; both read only this index
+        txn.exec("CREATE INDEX IF NOT EXISTS inspection_region_group_covering ON inspection_region "
+                 "(group_id) INCLUDE (coord_x, coord_y)");
+
+        // Crops filtering on a hot category scan only that category's entries
+        for (int category : indexes_.hot_categories) {
+            txn.exec("CREATE INDEX IF NOT EXISTS inspection_region_yx_category_" + std::to_string(category) +
+                     " ON inspection_region "
+                     "(coord_y, coord_x, id) INCLUDE (group_id, category) WHERE category = " + std::to_string(category));
+        }
+
+        // Rows are in key order, so each block range covers a narrow key
+        // interval and a BRIN summary (a few bytes per 16 pages) is enough to
+        // skip every block outside a crop's key ranges
+        if (cluster_) {
+            txn.exec("CREATE INDEX IF NOT EXISTS inspection_region_key_brin ON inspection_region "
+                     "USING brin (spatial_key) WITH (pages_per_range = 16)");
+        }
+
+        std::cout << "Database indexes created/verified" << std::endl;
     }
 };
 
 int main(int argc, char* argv[]) {
-    // Simple command line argument parsing for --data_directory
+    // Simple command line argument parsing for --data_directory, --snapshot, partitioning, clustering and indexes
     std::string data_directory;
+    std::string snapshot_file;
+    PartitionOptions partitions;
+    std::string partition_count;
+    std::string hot_categories;
+    std::string cluster = "none";
+    IndexOptions indexes;
     
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--data_directory" && i + 1 < argc) {
             data_directory = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshot_file = argv[++i];
+        } else if (arg == "--partition" && i + 1 < argc) {
+            partitions.scheme = argv[++i];
+        } else if (arg == "--partitions" && i + 1 < argc) {
+            partition_count = argv[++i];
+        } else if (arg == "--cluster" && i + 1 < argc) {
+            cluster = argv[++i];
+        } else if (arg == "--hot-categories" && i + 1 < argc) {
+            hot_categories = argv[++i];
+        } else if (arg == "--repartition") {
+            partitions.repartition = true;
+        } else if (arg == "--no-vacuum") {
+            indexes.vacuum = false;
         }
     }
 
     if (data_directory.empty()) {
-        std::cerr << "Usage: " << argv[0] << " --data_directory <path>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " --data_directory <path> [--snapshot <regions.snap>]"
+                  << " [--partition none|tiles|group_hash] [--partitions <n>] [--repartition] [--cluster none|hilbert]"
+                  << " [--hot-categories <c1,c2,...>] [--no-vacuum]" << std::endl;
+        return 1;
+    }
+
+    if (cluster != "none" && cluster != "hilbert") {
+        std::cerr << "Unknown clustering: " << cluster << std::endl;
+        return 1;
+    }
+
+    // Categories are non-negative integers
+    std::istringstream list(hot_categories);
+    std::string category;
+    while (std::getline(list, category, ',')) {
+        size_t value = 0;
+        if (!parseCount(category, value) || value > static_cast<size_t>(std::numeric_limits<int>::max())) {
+            std::cerr << "Invalid hot category: " << category << std::endl;
+            return 1;
+        }
+        indexes.hot_categories.push_back(static_cast<int>(value));
+    }
+
+    if (partitions.scheme != "none" && partitions.scheme != "tiles" && partitions.scheme != "group_hash") {
+        std::cerr << "Unknown partition scheme: " << partitions.scheme << std::endl;
+        return 1;
+    }
+
+    if (!partition_count.empty() && (!parseCount(partition_count, partitions.count) || partitions.count == 0)) {
+        std::cerr << "Invalid partition count: " << partition_count << std::endl;
         return 1;
     }
 
@@ -263,7 +654,7 @@ int main(int argc, char* argv[]) {
     std::string connection_string = "dbname=inspection_db user=postgres password=password host=localhost port=5432";
     
     try {
-        DataLoader loader(connection_string);
+        DataLoader loader(connection_string, snapshot_file, partitions, cluster == "hilbert", indexes);
         
         if (loader.loadData(data_directory)) {
             std::cout << "Data loading completed successfully!" << std::endl;
@@ -3,9 +3,14 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <sstream>
 #include <pqxx/pqxx>
 #include <nlohmann/json.hpp>
 
+#include "../solution 3/hilbert_key.h"
+#include "../solution 3/radix_sort.h"
+
 using json = nlohmann::json;
 
 struct Point {
@@ -28,6 +33,15 @@ struct QueryParams {
     int category = -1; // -1 means not specified
     std::vector<long> one_of_groups;
     bool proper = false;
+    
+    // Page of the (y, x) ordered result: points strictly after the cursor,
+    // skipping offset of them, at most limit of them (-1 means no limit)
+    long limit = -1;
+    long offset = 0;
+    bool has_after = false;
+    Point after;
+    
+    bool paged() const { return limit >= 0 || offset > 0 || has_after; }
 };
 
 struct InspectionPoint {
@@ -38,35 +52,65 @@ struct InspectionPoint {
     int category;
 };
 
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
 class RegionQuery {
 private:
     std::string connection_string_;
+    std::string profile_file_;   // JSON trace destination, empty when not profiling
+    json trace_;
     
 public:
-    RegionQuery(const std::string& conn_str) : connection_string_(conn_str) {}
+    RegionQuery(const std::string& conn_str, const std::string& profile_file = "")
+        : connection_string_(conn_str), profile_file_(profile_file) {}
     
     bool executeQuery(const std::string& query_file, const std::string& output_file) {
         try {
+            trace_ = {{"phases", json::array()}, {"nodes", json::array()}};
+            
             // Parse JSON query
+            auto phase_start = Clock::now();
             auto query_params = parseQueryFile(query_file);
+            addPhase("parse", elapsedMs(phase_start));
             if (!query_params.has_value()) {
                 return false;
             }
             
             // Execute query against database
+            phase_start = Clock::now();
             auto points = executeDatabaseQuery(query_params.value());
+            addPhase("execute", elapsedMs(phase_start));
             if (!points.has_value()) {
                 return false;
             }
             
-            // Sort points by (y, x)
-            std::sort(points->begin(), points->end(), [](const InspectionPoint& a, const InspectionPoint& b) {
-                if (a.y != b.y) return a.y < b.y;
-                return a.x < b.x;
-            });
+            // Sort points by (y, x), unless the paged statement already did
+            phase_start = Clock::now();
+            if (!query_params->paged()) {
+                RadixSort::sortByYX(*points, [](const InspectionPoint& p) { return p.y; },
+                                    [](const InspectionPoint& p) { return p.x; });
+            }
+            addPhase("sort", elapsedMs(phase_start));
             
             // Write output file
-            return writeOutputFile(output_file, points.value());
+            phase_start = Clock::now();
+            bool written = writeOutputFile(output_file, points.value());
+            addPhase("output", elapsedMs(phase_start));
+            
+            if (!profile_file_.empty()) {
+                std::ofstream file(profile_file_);
+                if (!file.is_open()) {
+                    std::cerr << "Cannot write profile trace: " << profile_file_ << std::endl;
+                    return false;
+                }
+                file << trace_.dump(2) << std::endl;
+                std::cout << "Profile trace written to: " << profile_file_ << std::endl;
+            }
+            return written;
             
         } catch (const std::exception& e) {
             std::cerr << "Error executing query: " << e.what() << std::endl;
@@ -75,6 +119,10 @@ public:
     }
     
 private:
+    void addPhase(const std::string& name, double ms) {
+        trace_["phases"].push_back({{"name", name}, {"ms", ms}});
+    }
+    
     std::optional<QueryParams> parseQueryFile(const std::string& query_file) {
         try {
             std::ifstream file(query_file);
@@ -110,6 +158,29 @@ private:
                 params.proper = crop["proper"];
             }
             
+            // Optional page of the result. Floats such as 1e3 or 2.5 are
+            // refused rather than truncated; unsigned values past a long
+            // wrap negative and are refused too.
+            if (j.contains("limit") && !j["limit"].is_null()) {
+                if (!j["limit"].is_number_integer() || j["limit"].get<long>() < 0) {
+                    std::cerr << "limit must be a non-negative integer" << std::endl;
+                    return std::nullopt;
+                }
+                params.limit = j["limit"].get<long>();
+            }
+            if (j.contains("offset") && !j["offset"].is_null()) {
+                if (!j["offset"].is_number_integer() || j["offset"].get<long>() < 0) {
+                    std::cerr << "offset must be a non-negative integer" << std::endl;
+                    return std::nullopt;
+                }
+                params.offset = j["offset"].get<long>();
+            }
+            if (j.contains("after") && !j["after"].is_null()) {
+                params.has_after = true;
+                params.after.x = j["after"]["x"];
+                params.after.y = j["after"]["y"];
+            }
+            
             std::cout << "Parsed query: region=(" << params.region.p_min.x << "," << params.region.p_min.y 
                       << ")-(" << params.region.p_max.x << "," << params.region.p_max.y << ")" 
                       << ", category=" << (params.category != -1 ? std::to_string(params.category) : "any")
@@ -126,13 +197,26 @@ private:
     
     std::optional<std::vector<InspectionPoint>> executeDatabaseQuery(const QueryParams& params) {
         try {
+            // The single crop is the only operator node in the trace
+            auto node_start = Clock::now();
+            json node = {{"index", 0}, {"parent", nullptr}, {"node", 0}, {"type", "CROP"}};
+            
+            auto step_start = Clock::now();
             pqxx::connection conn(connection_string_);
             pqxx::work txn(conn);
+            double connect_ms = elapsedMs(step_start);
             
-            std::string query = buildQuery(params);
+            // A table the loader clustered by Hilbert key is cropped through key ranges
+            auto curve = loadCurve(txn);
+            std::string groups;
+            std::string query = buildQuery(params, groups, curve ? &*curve : nullptr);
             std::cout << "Executing query: " << query << std::endl;
             
-            auto result = txn.exec(query);
+            step_start = Clock::now();
+            auto result = groups.empty() ? txn.exec(query) : txn.exec_params(query, groups);
+            double sql_ms = elapsedMs(step_start);
+            
+            step_start = Clock::now();
             std::vector<InspectionPoint> points;
             
             for (const auto& row : result) {
@@ -144,6 +228,28 @@ private:
                 point.category = row["category"].as<int>();
                 points.push_back(point);
             }
+            double decode_ms = elapsedMs(step_start);
+            
+            double wall_ms = elapsedMs(node_start);
+            
+            if (!profile_file_.empty()) {
+                // Server-side plan with actual timings and buffer usage; the
+                // statement runs a second time, after the measured run
+                std::string explain = "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) " + query;
+                auto plan = groups.empty() ? txn.exec(explain) : txn.exec_params(explain, groups);
+                node["detail"] = query;
+                node["cached"] = false;
+                node["wall_ms"] = wall_ms;
+                node["rows_in"] = result.size();
+                node["rows_out"] = points.size();
+                node["steps_ms"] = {{"connect", connect_ms}, {"sql", sql_ms}, {"decode", decode_ms}};
+                node["statements"] = json::array({{
+                    {"sql", query},
+                    {"ms", sql_ms},
+                    {"explain", plan.empty() ? json() : json::parse(plan[0][0].as<std::string>())},
+                }});
+                trace_["nodes"].push_back(node);
+            }
             
             std::cout << "Found " << points.size() << " points" << std::endl;
             return points;
@@ -154,7 +260,26 @@ private:
         }
     }
     
-    std::string buildQuery(const QueryParams& params) {
+    // Extent of the curve the loader keyed the rows on (--cluster hilbert), if
+    // inspection_region still has the spatial_key column the ranges filter on
+    static std::optional<HilbertKey> loadCurve(pqxx::work& txn) {
+        auto exists = txn.exec("SELECT to_regclass('inspection_region_curve') IS NOT NULL AND EXISTS ("
+                               "SELECT 1 FROM pg_attribute WHERE attrelid = to_regclass('inspection_region') "
+                               "AND attname = 'spatial_key' AND NOT attisdropped) AS clustered");
+        if (!exists[0]["clustered"].as<bool>()) {
+            return std::nullopt;
+        }
+        auto extent = txn.exec("SELECT min_x, min_y, max_x, max_y FROM inspection_region_curve");
+        if (extent.size() != 1) {
+            return std::nullopt;
+        }
+        return HilbertKey(extent[0]["min_x"].as<double>(), extent[0]["min_y"].as<double>(),
+                          extent[0]["max_x"].as<double>(), extent[0]["max_y"].as<double>());
+    }
+    
+    // A one_of_groups filter binds its ids as $1, one bigint[] whose array
+    // literal goes to groups, so the statement text does not grow with the list
+    std::string buildQuery(const QueryParams& params, std::string& groups, const HilbertKey* curve = nullptr) {
         std::string query = 
             "SELECT ir.id, ir.group_id, ir.coord_x, ir.coord_y, ir.category "
             "FROM inspection_region ir ";
@@ -180,24 +305,72 @@ private:
                  "ir.coord_y BETWEEN " + std::to_string(params.region.p_min.y) + 
                  " AND " + std::to_string(params.region.p_max.y);
         
+        // Key ranges covering the rectangle, widened by the 1e-6 std::to_string
+        // may round its bounds by; the BRIN index on spatial_key skips the
+        // block ranges outside them
+        if (curve) {
+            const double slack = 1e-6;
+            auto ranges = curve->ranges(params.region.p_min.x - slack, params.region.p_min.y - slack,
+                                        params.region.p_max.x + slack, params.region.p_max.y + slack);
+            if (ranges.empty()) {
+                query += " AND FALSE";
+            } else {
+                query += " AND (";
+                for (size_t i = 0; i < ranges.size(); ++i) {
+                    if (i > 0) query += " OR ";
+                    query += "ir.spatial_key BETWEEN " + std::to_string(ranges[i].first) +
+                             " AND " + std::to_string(ranges[i].second);
+                }
+                query += ")";
+            }
+        }
+        
         // Add category filter if specified
         if (params.category != -1) {
             query += " AND ir.category = " + std::to_string(params.category);
         }
         
         // Add groups filter if specified
+        groups.clear();
         if (!params.one_of_groups.empty()) {
-            query += " AND ir.group_id IN (";
+            groups = "{";
             for (size_t i = 0; i < params.one_of_groups.size(); ++i) {
-                if (i > 0) query += ", ";
-                query += std::to_string(params.one_of_groups[i]);
+                if (i > 0) groups += ",";
+                groups += std::to_string(params.one_of_groups[i]);
+            }
+            groups += "}";
+            query += " AND ir.group_id = ANY($1::bigint[])";
+        }
+        
+        // Keyset cursor, then (y, x) order so the server stops after the page
+        // with the loader's inspection_region_yx_covering index on
+        // (coord_y, coord_x, id) instead of sorting every match
+        if (params.has_after) {
+            query += " AND (ir.coord_y, ir.coord_x) > (" + sqlNumber(params.after.y) +
+                     ", " + sqlNumber(params.after.x) + ")";
+        }
+        if (params.paged()) {
+            query += " ORDER BY ir.coord_y, ir.coord_x, ir.id";
+            if (params.limit >= 0) {
+                query += " LIMIT " + std::to_string(params.limit);
+            }
+            if (params.offset > 0) {
+                query += " OFFSET " + std::to_string(params.offset);
             }
-            query += ")";
         }
         
         return query;
     }
     
+    // Round-trips the double, as the output file does, so a cursor copied from
+    // the last written point matches it exactly
+    static std::string sqlNumber(double value) {
+        std::ostringstream out;
+        out.precision(17);
+        out << value;
+        return out.str();
+    }
+    
     bool writeOutputFile(const std::string& output_file, const std::vector<InspectionPoint>& points) {
         try {
             std::ofstream file(output_file);
@@ -206,7 +379,9 @@ private:
                 return false;
             }
             
-            // Write points in format: x y
+            // Write points in format: x y, with every digit needed to read the double
+            // back, so the last point of a page can be passed as the next page's cursor
+            file.precision(17);
             for (const auto& point : points) {
                 file << point.x << " " << point.y << std::endl;
             }
@@ -224,6 +399,7 @@ private:
 int main(int argc, char* argv[]) {
     std::string query_file;
     std::string output_file = "output.txt";
+    std::string profile_file;
     
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
@@ -232,11 +408,14 @@ int main(int argc, char* argv[]) {
             query_file = argv[++i];
         } else if (arg == "--output" && i + 1 < argc) {
             output_file = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            profile_file = argv[++i];
         }
     }
     
     if (query_file.empty()) {
-        std::cerr << "Usage: " << argv[0] << " --query <query_file.json> [--output <output_file.txt>]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " --query <query_file.json> [--output <output_file.txt>]"
+                  << " [--profile <trace.json>]" << std::endl;
         return 1;
     }
     
@@ -249,7 +428,7 @@ int main(int argc, char* argv[]) {
     std::string connection_string = "dbname=inspection_db user=kyi host=localhost port=5432";
     
     try {
-        RegionQuery query(connection_string);
+        RegionQuery query(connection_string, profile_file);
         
         if (query.executeQuery(query_file, output_file)) {
             std::cout << "Query executed successfully!" << std::endl;
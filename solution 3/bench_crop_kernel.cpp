@@ -0,0 +1,94 @@
+// Throughput of the in-memory crop kernels, one line per ISA this CPU runs,
+// followed by the float32 and fixed32 compact columns (scalar and SIMD, exact
+// recheck included). Points are uniform over [0, 1000]^2 and crops are sized
+// for a range of selectivities, with and without a category filter. Every
+// kernel's output is checked against the scalar one.
+//
+//   ./bench_crop_kernel [--points 10000000] [--runs 5]
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench_data.h"
+#include "crop_kernel.h"
+#include "quantized_columns.h"
+
+int main(int argc, char* argv[]) {
+    size_t points = 10000000;
+    int runs = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--points" && i + 1 < argc) {
+            points = std::stoul(argv[++i]);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::stoi(argv[++i]);
+        }
+    }
+
+    try {
+        RegionStore store = uniformPoints(points, 1000.0, 1);
+        std::vector<size_t> expected(store.size());
+        std::vector<size_t> out(store.size());
+        std::cout << store.size() << " points, best of " << runs << " runs" << std::endl;
+
+        std::vector<QuantizedColumns> compact;
+        compact.emplace_back(store, QuantizedColumns::Encoding::Float32);
+        compact.emplace_back(store, QuantizedColumns::Encoding::Fixed32);
+
+        // Times select, keeping the fastest run, and checks it against the scalar selection
+        auto measure = [&](const std::string& name, size_t expected_count, const std::function<size_t()>& select,
+                           const std::string& label) {
+            double best_ns = 0.0;
+            size_t count = 0;
+            for (int run = 0; run < runs; ++run) {
+                auto start = std::chrono::steady_clock::now();
+                count = select();
+                double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                if (run == 0 || ns < best_ns) best_ns = ns;
+            }
+            if (count != expected_count || !std::equal(out.begin(), out.begin() + count, expected.begin())) {
+                throw std::runtime_error(name + " kernel selected different points");
+            }
+            std::cout << label << " " << name << ": " << store.size() / best_ns << " points/ns, "
+                      << count << " selected" << std::endl;
+        };
+
+        for (double selectivity : {0.01, 0.1, 0.5}) {
+            for (bool with_category : {false, true}) {
+                double side = 1000.0 * std::sqrt(selectivity);
+                CropKernel::Filter filter;
+                filter.region = {500.0 - side / 2, 500.0 - side / 2, 500.0 + side / 2, 500.0 + side / 2};
+                filter.has_category = with_category;
+                filter.category = 2;
+
+                size_t expected_count = CropKernel::selectScalar(store.xs().data(), store.ys().data(),
+                                                                 store.categories().data(), store.size(),
+                                                                 filter, expected.data());
+                std::ostringstream label;
+                label << "selectivity " << selectivity * 100.0 << "%" << (with_category ? " +category" : "");
+                for (const CropKernel::Isa& isa : CropKernel::available()) {
+                    measure(isa.name, expected_count, [&]() {
+                        return isa.select(store.xs().data(), store.ys().data(), store.categories().data(),
+                                          store.size(), filter, out.data());
+                    }, label.str());
+                }
+                for (const QuantizedColumns& columns : compact) {
+                    for (bool simd : {false, true}) {
+                        measure(std::string(columns.name()) + (simd ? " simd" : " scalar"), expected_count,
+                                [&]() { return columns.select(filter, out.data(), simd); }, label.str());
+                    }
+                }
+            }
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+// Datasets shared by the benchmarks: a data/<n> directory read straight from
+// its text files (ids numbered from 1 like the loader does), and synthetic
+// uniform or clustered point clouds.
+
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "region_store.h"
+
+inline RegionStore loadDataDirectory(const std::string& directory) {
+    std::ifstream points(directory + "/points.txt");
+    std::ifstream groups(directory + "/groups.txt");
+    std::ifstream categories(directory + "/categories.txt");
+    if (!points.is_open() || !groups.is_open() || !categories.is_open()) {
+        throw std::runtime_error("Cannot read data directory: " + directory);
+    }
+
+    RegionStore store;
+    double x, y, group, category;
+    long id = 1;
+    while (points >> x >> y && groups >> group && categories >> category) {
+        store.append(id++, static_cast<long>(group), x, y, static_cast<int>(category));
+    }
+    return store;
+}
+
+// Points spread evenly over [0, extent]^2, in groups of about 10 nearby points
+inline RegionStore uniformPoints(size_t count, double extent, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> coord(0.0, extent);
+    std::normal_distribution<double> jitter(0.0, extent / 1000.0);
+    std::uniform_int_distribution<int> category(0, 4);
+
+    RegionStore store;
+    store.reserve(count);
+    double center_x = 0.0, center_y = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 10 == 0) {
+            center_x = coord(rng);
+            center_y = coord(rng);
+        }
+        store.append(static_cast<long>(i + 1), static_cast<long>(i / 10),
+                     center_x + jitter(rng), center_y + jitter(rng), category(rng));
+    }
+    return store;
+}
+
+// Most points packed into a few tight clusters over a sparse background,
+// the worst case for a fixed grid
+inline RegionStore skewedPoints(size_t count, double extent, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> coord(0.0, extent);
+    std::uniform_int_distribution<int> category(0, 4);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    const int clusters = 8;
+    std::vector<std::pair<double, double>> centers;
+    for (int c = 0; c < clusters; ++c) centers.emplace_back(coord(rng), coord(rng));
+    std::normal_distribution<double> spread(0.0, extent / 200.0);
+    std::uniform_int_distribution<int> pick(0, clusters - 1);
+
+    RegionStore store;
+    store.reserve(count);
+    double x = 0.0, y = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        if (percent(rng) < 90) {
+            const auto& center = centers[pick(rng)];
+            x = center.first + spread(rng);
+            y = center.second + spread(rng);
+        } else {
+            x = coord(rng);
+            y = coord(rng);
+        }
+        store.append(static_cast<long>(i + 1), static_cast<long>(i / 10), x, y, category(rng));
+    }
+    return store;
+}
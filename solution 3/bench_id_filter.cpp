@@ -0,0 +1,129 @@
+// Cost of the id lists AND / OR send to the server, by list size. The same
+// random ids of inspection_region are fetched three ways: a literal
+// "id IN (1, 2, ...)" list, one bigint[] parameter with "id = ANY($1)", and
+// the parameter unnested into a subquery. Per size and form it prints the
+// statement length, the best end-to-end time (build, send, parse, plan,
+// execute and receive) and the rows returned, which must agree. Unlike the
+// other benchmarks it needs the database loaded by data_loader.
+//
+//   ./bench_id_filter [--sizes 10,100,1000,10000,100000] [--runs 5]
+//                     [--connection "dbname=inspection_db ..."]
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <pqxx/pqxx>
+
+namespace {
+
+const char* SELECT_REGIONS = "SELECT id, group_id, coord_x, coord_y, category FROM inspection_region WHERE ";
+
+std::string literalList(const std::vector<long>& ids) {
+    std::string list;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0) list += ", ";
+        list += std::to_string(ids[i]);
+    }
+    return list;
+}
+
+std::string arrayLiteral(const std::vector<long>& ids) {
+    std::string array = "{";
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0) array += ",";
+        array += std::to_string(ids[i]);
+    }
+    return array + "}";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {10, 100, 1000, 10000, 100000};
+    int runs = 5;
+    std::string connection_string = "dbname=inspection_db user=kyi host=localhost port=5432";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc) {
+            sizes.clear();
+            std::istringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ',')) {
+                sizes.push_back(std::stoul(size));
+            }
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::stoi(argv[++i]);
+        } else if (arg == "--connection" && i + 1 < argc) {
+            connection_string = argv[++i];
+        }
+    }
+
+    try {
+        pqxx::connection conn(connection_string);
+        std::vector<long> all_ids;
+        {
+            pqxx::work txn(conn);
+            for (const auto& row : txn.exec("SELECT id FROM inspection_region")) {
+                all_ids.push_back(row[0].as<long>());
+            }
+        }
+        if (all_ids.empty()) {
+            throw std::runtime_error("inspection_region is empty, run data_loader first");
+        }
+        std::cout << all_ids.size() << " regions, best of " << runs << " runs" << std::endl;
+
+        std::mt19937_64 random(1);
+        for (size_t size : sizes) {
+            size = std::min(size, all_ids.size());
+            std::shuffle(all_ids.begin(), all_ids.end(), random);
+            std::vector<long> ids(all_ids.begin(), all_ids.begin() + size);
+
+            // Each form builds its statement inside the timed run, as the query program does
+            auto measure = [&](const std::string& name, const std::function<pqxx::result(pqxx::work&, size_t&)>& run) {
+                double best_ms = 0.0;
+                size_t length = 0;
+                size_t rows = 0;
+                for (int r = 0; r < runs; ++r) {
+                    pqxx::work txn(conn);
+                    auto start = std::chrono::steady_clock::now();
+                    rows = run(txn, length).size();
+                    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    if (r == 0 || ms < best_ms) best_ms = ms;
+                }
+                if (rows != size) {
+                    throw std::runtime_error(name + " returned " + std::to_string(rows) + " rows for " +
+                                             std::to_string(size) + " ids");
+                }
+                std::cout << size << " ids " << name << ": " << best_ms << " ms, "
+                          << length << " statement bytes, " << rows << " rows" << std::endl;
+            };
+
+            measure("in_list", [&](pqxx::work& txn, size_t& length) {
+                std::string query = std::string(SELECT_REGIONS) + "id IN (" + literalList(ids) + ")";
+                length = query.size();
+                return txn.exec(query);
+            });
+            measure("any_array", [&](pqxx::work& txn, size_t& length) {
+                std::string query = std::string(SELECT_REGIONS) + "id = ANY($1::bigint[])";
+                length = query.size();
+                return txn.exec_params(query, arrayLiteral(ids));
+            });
+            measure("unnest", [&](pqxx::work& txn, size_t& length) {
+                std::string query = std::string(SELECT_REGIONS) + "id IN (SELECT unnest($1::bigint[]))";
+                length = query.size();
+                return txn.exec_params(query, arrayLiteral(ids));
+            });
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
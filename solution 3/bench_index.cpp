@@ -0,0 +1,169 @@
+// Spatial index benchmark for the in-memory engine.
+// Builds every index over the same points and times random crops of several
+// sizes against a plain linear scan, on a data directory and on synthetic
+// uniform and skewed (clustered) clouds. Crop centers are drawn from the
+// points themselves so dense areas are queried as often as they occur.
+//
+//   ./bench_index [--data ../data/1] [--points 1000000] [--queries 2000]
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_data.h"
+#include "grid_index.h"
+#include "hilbert_rtree.h"
+#include "kd_tree.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Bounds {
+    double min_x, min_y, max_x, max_y;
+};
+
+static Bounds extentOf(const RegionStore& store) {
+    Bounds bounds{store.xs()[0], store.ys()[0], store.xs()[0], store.ys()[0]};
+    for (size_t i = 0; i < store.size(); ++i) {
+        bounds.min_x = std::min(bounds.min_x, store.xs()[i]);
+        bounds.min_y = std::min(bounds.min_y, store.ys()[i]);
+        bounds.max_x = std::max(bounds.max_x, store.xs()[i]);
+        bounds.max_y = std::max(bounds.max_y, store.ys()[i]);
+    }
+    return bounds;
+}
+
+// Square crops covering fraction of the extent's area
+static std::vector<Region> randomCrops(const RegionStore& store, double fraction, size_t count, std::mt19937& rng) {
+    Bounds bounds = extentOf(store);
+    double half_w = (bounds.max_x - bounds.min_x) * std::sqrt(fraction) / 2.0;
+    double half_h = (bounds.max_y - bounds.min_y) * std::sqrt(fraction) / 2.0;
+    std::uniform_int_distribution<size_t> pick(0, store.size() - 1);
+
+    std::vector<Region> crops;
+    for (size_t i = 0; i < count; ++i) {
+        size_t row = pick(rng);
+        double x = store.xs()[row], y = store.ys()[row];
+        crops.push_back({x - half_w, y - half_h, x + half_w, y + half_h});
+    }
+    return crops;
+}
+
+using CropFunction = std::function<size_t(const Region&)>;
+
+struct Candidate {
+    std::string name;
+    CropFunction crop;
+};
+
+static void runCrops(const std::vector<Candidate>& candidates, const std::vector<Region>& crops, double fraction) {
+    std::vector<size_t> expected;
+    for (const Candidate& candidate : candidates) {
+        auto start = Clock::now();
+        size_t total = 0;
+        std::vector<size_t> counts;
+        for (const Region& crop : crops) {
+            counts.push_back(candidate.crop(crop));
+            total += counts.back();
+        }
+        double ms = elapsedMs(start);
+
+        if (expected.empty()) {
+            expected = counts;
+        } else if (counts != expected) {
+            throw std::runtime_error(candidate.name + " returned different rows than the linear scan");
+        }
+        std::cout << "  crop " << fraction * 100.0 << "% " << candidate.name << ": "
+                  << (ms * 1000.0 / crops.size()) << " us/query, "
+                  << (total / crops.size()) << " rows/query" << std::endl;
+    }
+}
+
+static void runDataset(const std::string& name, const RegionStore& store, size_t queries) {
+    std::cout << name << ": " << store.size() << " points" << std::endl;
+
+    auto start = Clock::now();
+    KdTree kd_tree(store);
+    std::cout << "  build kdtree: " << elapsedMs(start) << " ms, " << kd_tree.nodeCount() << " nodes" << std::endl;
+
+    std::vector<HilbertRTree> rtrees;
+    for (size_t fanout : {16, 32, 64}) {
+        start = Clock::now();
+        rtrees.emplace_back(store, fanout);
+        std::cout << "  build rtree" << fanout << ": " << elapsedMs(start) << " ms, "
+                  << rtrees.back().nodeCount() << " nodes, height " << rtrees.back().height() << std::endl;
+    }
+
+    start = Clock::now();
+    GridIndex grid(store);
+    std::cout << "  build grid: " << elapsedMs(start) << " ms, " << grid.columns() << "x" << grid.rows()
+              << " cells" << std::endl;
+
+    std::vector<Candidate> candidates;
+    candidates.push_back({"scan", [&store](const Region& region) {
+        size_t count = 0;
+        for (size_t i = 0; i < store.size(); ++i) {
+            double x = store.xs()[i], y = store.ys()[i];
+            count += x >= region.p_min_x && x <= region.p_max_x && y >= region.p_min_y && y <= region.p_max_y;
+        }
+        return count;
+    }});
+    candidates.push_back({"kdtree", [&kd_tree](const Region& region) {
+        size_t count = 0;
+        kd_tree.crop(region, [&count](uint32_t) { ++count; });
+        return count;
+    }});
+    for (const HilbertRTree& rtree : rtrees) {
+        candidates.push_back({"rtree" + std::to_string(rtree.fanout()), [&rtree](const Region& region) {
+            size_t count = 0;
+            rtree.crop(region, [&count](uint32_t) { ++count; });
+            return count;
+        }});
+    }
+
+    candidates.push_back({"grid", [&grid](const Region& region) {
+        size_t count = 0;
+        grid.crop(region, [&count](uint32_t) { ++count; });
+        return count;
+    }});
+
+    std::mt19937 rng(7);
+    for (double fraction : {0.0001, 0.01, 0.1}) {
+        // The linear scan is slow enough to need fewer queries on large inputs
+        size_t count = std::max<size_t>(10, std::min(queries, queries * 100000 / std::max<size_t>(1, store.size())));
+        runCrops(candidates, randomCrops(store, fraction, count, rng), fraction);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string data_directory = "../data/1";
+    size_t points = 1000000;
+    size_t queries = 2000;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc) {
+            data_directory = argv[++i];
+        } else if (arg == "--points" && i + 1 < argc) {
+            points = std::stoul(argv[++i]);
+        } else if (arg == "--queries" && i + 1 < argc) {
+            queries = std::stoul(argv[++i]);
+        }
+    }
+
+    try {
+        runDataset(data_directory, loadDataDirectory(data_directory), queries);
+        runDataset("uniform", uniformPoints(points, 1000.0, 1), queries);
+        runDataset("skewed", skewedPoints(points, 1000.0, 2), queries);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,135 @@
+// Parse-throughput benchmark for SimpleJsonParser.
+// Generates large query files (wide trees with thousands of operands and one
+// deeply nested chain), writes them to the temp directory and times
+// parseQueryFile on each.
+//
+//   ./bench_parser [--size_mb 10] [--depth 10000] [--runs 5]
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "query_parser.h"
+
+namespace fs = std::filesystem;
+
+static std::string randomCrop(std::mt19937& rng) {
+    std::uniform_real_distribution<double> coord(0.0, 1000.0);
+    std::uniform_int_distribution<int> small(0, 9);
+
+    double x = coord(rng), y = coord(rng);
+    std::string crop = "{ \"operator_crop\": { \"region\": { \"p_min\": { \"x\": " + std::to_string(x) +
+                       ", \"y\": " + std::to_string(y) + " }, \"p_max\": { \"x\": " + std::to_string(x + 100.0) +
+                       ", \"y\": " + std::to_string(y + 100.0) + " } }";
+    if (small(rng) < 3) {
+        crop += ", \"category\": " + std::to_string(small(rng) % 3);
+    }
+    if (small(rng) < 3) {
+        crop += ", \"one_of_groups\": [";
+        for (int i = 0; i < 8; ++i) {
+            crop += (i ? ", " : "") + std::to_string(small(rng) * 1000 + i);
+        }
+        crop += "]";
+    }
+    if (small(rng) < 2) {
+        crop += ", \"proper\": true";
+    }
+    return crop + " } }";
+}
+
+// OR over many ANDs, each holding a few crops and a nested OR
+static std::string generateWide(size_t target_bytes, std::mt19937& rng) {
+    std::string json = "{\n  \"valid_region\": { \"p_min\": { \"x\": 0, \"y\": 0 }, \"p_max\": { \"x\": 1000, \"y\": 1000 } },\n"
+                       "  \"query\": { \"operator_or\": [\n";
+    bool first = true;
+    while (json.size() < target_bytes) {
+        if (!first) json += ",\n";
+        first = false;
+        json += "    { \"operator_and\": [ " + randomCrop(rng) + ", " + randomCrop(rng) +
+                ", { \"operator_or\": [ " + randomCrop(rng) + ", " + randomCrop(rng) + " ] } ] }";
+    }
+    return json + "\n  ] }\n}\n";
+}
+
+// AND/OR chain nested depth levels deep
+static std::string generateDeep(size_t depth, std::mt19937& rng) {
+    std::string json = "{ \"query\": ";
+    for (size_t i = 0; i < depth; ++i) {
+        json += std::string("{ \"") + (i % 2 ? "operator_or" : "operator_and") + "\": [ " + randomCrop(rng) + ", ";
+    }
+    json += randomCrop(rng);
+    for (size_t i = 0; i < depth; ++i) {
+        json += " ] }";
+    }
+    return json + " }\n";
+}
+
+static size_t countNodes(const QueryTree& tree) {
+    // Iterative so deep chains do not exhaust the stack
+    size_t count = 0;
+    std::vector<NodeId> pending = {tree.root()};
+    while (!pending.empty()) {
+        NodeId id = pending.back();
+        pending.pop_back();
+        ++count;
+        const QueryNode& node = tree.node(id);
+        if (const auto* and_node = std::get_if<AndNode>(&node)) {
+            for (NodeId operand : tree.operands(and_node->operands)) pending.push_back(operand);
+        } else if (const auto* or_node = std::get_if<OrNode>(&node)) {
+            for (NodeId operand : tree.operands(or_node->operands)) pending.push_back(operand);
+        }
+    }
+    return count;
+}
+
+static void runCase(const std::string& name, const std::string& json, int runs) {
+    fs::path path = fs::temp_directory_path() / ("bench_parser_" + name + ".json");
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << json;
+    }
+
+    double best_ms = 0.0;
+    size_t nodes = 0;
+    for (int run = 0; run < runs; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        QueryTree tree = SimpleJsonParser::parseQueryFile(path.string());
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || ms < best_ms) best_ms = ms;
+        nodes = countNodes(tree);
+    }
+
+    double mb = json.size() / (1024.0 * 1024.0);
+    std::cout << name << ": " << mb << " MB, " << nodes << " nodes, best of " << runs << " runs "
+              << best_ms << " ms, " << (mb / (best_ms / 1000.0)) << " MB/s" << std::endl;
+    fs::remove(path);
+}
+
+int main(int argc, char* argv[]) {
+    double size_mb = 10.0;
+    size_t depth = 10000;
+    int runs = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--size_mb" && i + 1 < argc) {
+            size_mb = std::stod(argv[++i]);
+        } else if (arg == "--depth" && i + 1 < argc) {
+            depth = std::stoul(argv[++i]);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::stoi(argv[++i]);
+        }
+    }
+
+    try {
+        std::mt19937 rng(42);
+        runCase("wide", generateWide(static_cast<size_t>(size_mb * 1024 * 1024), rng), runs);
+        runCase("deep", generateDeep(depth, rng), runs);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,98 @@
+// Result ordering benchmark: RadixSort::sortByYX, the comparator std::sort the
+// query programs use, against RadixSort::radixSortByYX, the parallel radix
+// sort, on result-sized arrays of points for sizes from 1e3 to --max-size.
+// Coordinates come from uniform points, half of them with a repeated y so the
+// tie-break on x is exercised. Both orders are compared.
+//
+//   ./bench_radix_sort [--max-size 100000000] [--runs 3] [--threads 0]
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "radix_sort.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Same layout as the query programs' InspectionPoint
+struct Point {
+    long id;
+    long group_id;
+    double x;
+    double y;
+    int category;
+};
+
+static std::vector<Point> randomPoints(size_t count, uint32_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> coordinate(-1000.0, 1000.0);
+    std::vector<Point> points(count);
+    for (size_t i = 0; i < count; ++i) {
+        double y = i % 2 == 1 ? points[i - 1].y : coordinate(rng);
+        points[i] = {static_cast<long>(i + 1), static_cast<long>(i / 10), coordinate(rng), y, static_cast<int>(i % 8)};
+    }
+    return points;
+}
+
+// Best time of runs sorts, each on a fresh copy of input
+static double bestMs(const std::vector<Point>& input, int runs, std::vector<Point>& output,
+                     const std::function<void(std::vector<Point>&)>& sort) {
+    double best_ms = 0.0;
+    for (int run = 0; run < runs; ++run) {
+        output = input;
+        auto start = Clock::now();
+        sort(output);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (run == 0 || ms < best_ms) best_ms = ms;
+    }
+    return best_ms;
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_size = 100000000;
+    int runs = 3;
+    size_t threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--max-size" && i + 1 < argc) {
+            max_size = std::stoul(argv[++i]);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::stoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        }
+    }
+
+    try {
+        std::cout << "best of " << runs << " runs, " << (threads > 0 ? threads : std::thread::hardware_concurrency())
+                  << " threads" << std::endl;
+        for (size_t size = 1000; size <= max_size; size *= 10) {
+            std::vector<Point> input = randomPoints(size, 1);
+            std::vector<Point> expected, sorted;
+
+            double comparator_ms = bestMs(input, runs, expected, [](std::vector<Point>& points) {
+                RadixSort::sortByYX(points, [](const Point& p) { return p.y; }, [](const Point& p) { return p.x; });
+            });
+            double radix_ms = bestMs(input, runs, sorted, [threads](std::vector<Point>& points) {
+                RadixSort::radixSortByYX(points, [](const Point& p) { return p.y; }, [](const Point& p) { return p.x; },
+                                    threads);
+            });
+
+            for (size_t i = 0; i < size; ++i) {
+                if (sorted[i].y != expected[i].y || sorted[i].x != expected[i].x) {
+                    throw std::runtime_error("radix sort order differs at size " + std::to_string(size));
+                }
+            }
+            std::cout << size << " points: std::sort " << comparator_ms << " ms, radix " << radix_ms
+                      << " ms, speedup " << comparator_ms / radix_ms << std::endl;
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,111 @@
+// Scaling of the morsel-driven parallel scan. Runs the full-scan crop kernel
+// and a compiled predicate (an AND over an OR of category crops) over uniform
+// points with 1, 2, 4, ... up to --max-threads workers and prints, per thread
+// count, the best time, throughput, speedup over one thread and parallel
+// efficiency. Every run's selection is checked against the one-thread result.
+// Thread counts above the machine's hardware threads are still run, to show
+// where the curve flattens.
+//
+//   ./bench_scan [--points 100000000] [--max-threads 64] [--runs 3]
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench_data.h"
+#include "compiled_predicate.h"
+#include "crop_kernel.h"
+#include "morsel_executor.h"
+#include "query_parser.h"
+
+using Clock = std::chrono::steady_clock;
+
+static const char* PREDICATE_QUERY = R"({
+  "query": {
+    "operator_and": [
+      { "operator_crop": { "region": { "p_min": { "x": 100, "y": 100 }, "p_max": { "x": 900, "y": 900 } } } },
+      { "operator_or": [
+        { "operator_crop": { "region": { "p_min": { "x": 0, "y": 0 }, "p_max": { "x": 600, "y": 600 } }, "category": 1 } },
+        { "operator_crop": { "region": { "p_min": { "x": 400, "y": 400 }, "p_max": { "x": 1000, "y": 1000 } }, "category": 2 } },
+        { "operator_crop": { "region": { "p_min": { "x": 200, "y": 0 }, "p_max": { "x": 800, "y": 1000 } }, "category": 3 } }
+      ] }
+    ]
+  }
+})";
+
+using Scan = std::function<std::vector<size_t>(const MorselExecutor&)>;
+
+static void runScaling(const std::string& name, size_t points, size_t max_threads, int runs, const Scan& scan) {
+    std::cout << name << ":" << std::endl;
+    std::vector<size_t> expected;
+    double single_ms = 0.0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        MorselExecutor executor(threads);
+        double best_ms = 0.0;
+        std::vector<size_t> rows;
+        for (int run = 0; run < runs; ++run) {
+            auto start = Clock::now();
+            rows = scan(executor);
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (run == 0 || ms < best_ms) best_ms = ms;
+        }
+
+        if (threads == 1) {
+            expected = rows;
+            single_ms = best_ms;
+        } else if (rows != expected) {
+            throw std::runtime_error(name + " on " + std::to_string(threads) + " threads selected different rows");
+        }
+        double speedup = single_ms / best_ms;
+        std::cout << "  " << threads << " threads: " << best_ms << " ms, " << points / (best_ms * 1e6)
+                  << " points/ns, speedup " << speedup << ", efficiency " << 100.0 * speedup / threads
+                  << "%, " << rows.size() << " selected" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t points = 100000000;
+    size_t max_threads = 64;
+    int runs = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--points" && i + 1 < argc) {
+            points = std::stoul(argv[++i]);
+        } else if (arg == "--max-threads" && i + 1 < argc) {
+            max_threads = std::stoul(argv[++i]);
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::stoi(argv[++i]);
+        }
+    }
+
+    try {
+        RegionStore store = uniformPoints(points, 1000.0, 1);
+        std::cout << store.size() << " points, " << std::thread::hardware_concurrency() << " hardware threads, "
+                  << MorselExecutor::MORSEL_SIZE << " rows per morsel, best of " << runs << " runs" << std::endl;
+
+        CropKernel::Filter filter;
+        filter.region = {300.0, 300.0, 616.0, 616.0};   // about 10% of the points
+        runScaling(std::string("crop kernel (") + CropKernel::best().name + ")", store.size(), max_threads, runs,
+                   [&store, &filter](const MorselExecutor& executor) {
+            return executor.select(store.size(), [&store, &filter](size_t begin, size_t end, size_t* out) {
+                size_t kept = CropKernel::select(store.xs().data() + begin, store.ys().data() + begin,
+                                                 store.categories().data() + begin, end - begin, filter, out);
+                for (size_t i = 0; i < kept; ++i) out[i] += begin;
+                return kept;
+            });
+        });
+
+        QueryTree tree = SimpleJsonParser::parseQueryString(PREDICATE_QUERY);
+        CompiledPredicate predicate(tree, store);
+        runScaling("compiled predicate", store.size(), max_threads, runs,
+                   [&predicate](const MorselExecutor& executor) { return predicate.scan(executor); });
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
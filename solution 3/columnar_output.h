@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Result points as a columnar binary file, for consumers that map it instead
+// of parsing text. Layout, every integer little-endian:
+//   header   magic "PTSCOLS\0", u32 version, u32 column count, u64 point count
+//   columns  per column: 16-byte NUL padded name, u32 type, u32 element size,
+//            u64 byte offset of its data
+//   data     each column a packed array of count elements, starting on a
+//            64-byte boundary (so mapped columns are aligned for any element)
+// Types are float64 (x, y), int64 (id, group_id) and int32 (category); which
+// fields are written is chosen by the caller, in the given order.
+class ColumnarOutput {
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t ALIGNMENT = 64;
+
+    enum class Type : uint32_t { Float64 = 1, Int64 = 2, Int32 = 3 };
+
+    // Comma separated field names: x, y, id, group_id, category
+    static std::vector<std::string> parseFields(const std::string& list) {
+        std::vector<std::string> fields;
+        std::istringstream in(list);
+        std::string field;
+        while (std::getline(in, field, ',')) {
+            if (typeOf(field) == UNKNOWN_TYPE) {
+                throw std::runtime_error("Unknown output field: " + field);
+            }
+            for (const std::string& seen : fields) {
+                if (seen == field) throw std::runtime_error("Output field listed twice: " + field);
+            }
+            fields.push_back(field);
+        }
+        if (fields.empty()) {
+            throw std::runtime_error("No output fields given");
+        }
+        return fields;
+    }
+
+    // Point needs the members x, y (double), id, group_id (integral) and category (int)
+    template <typename Point>
+    static void write(const std::string& path, const std::vector<Point>& points, const std::vector<std::string>& fields) {
+        size_t count = points.size();
+        uint64_t offset = alignUp(HEADER_SIZE + fields.size() * COLUMN_ENTRY_SIZE);
+        std::vector<uint64_t> offsets;
+
+        std::vector<char> header(HEADER_SIZE + fields.size() * COLUMN_ENTRY_SIZE, 0);
+        std::memcpy(header.data(), MAGIC, sizeof(MAGIC));
+        putLE(header.data() + 8, VERSION, 4);
+        putLE(header.data() + 12, fields.size(), 4);
+        putLE(header.data() + 16, count, 8);
+        for (size_t c = 0; c < fields.size(); ++c) {
+            Type type = typeOf(fields[c]);
+            char* entry = header.data() + HEADER_SIZE + c * COLUMN_ENTRY_SIZE;
+            std::memcpy(entry, fields[c].data(), std::min(fields[c].size(), NAME_SIZE - 1));
+            putLE(entry + NAME_SIZE, static_cast<uint32_t>(type), 4);
+            putLE(entry + NAME_SIZE + 4, sizeOf(type), 4);
+            putLE(entry + NAME_SIZE + 8, offset, 8);
+            offsets.push_back(offset);
+            offset = alignUp(offset + count * sizeOf(type));
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open output file: " + path);
+        }
+        file.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+        // Each column is encoded a chunk at a time into one reused buffer
+        std::vector<char> buffer;
+        for (size_t c = 0; c < fields.size(); ++c) {
+            pad(file, offsets[c]);
+            size_t size = sizeOf(typeOf(fields[c]));
+            for (size_t begin = 0; begin < count; begin += CHUNK) {
+                size_t end = std::min(count, begin + CHUNK);
+                buffer.resize((end - begin) * size);
+                encode(points, begin, end, fields[c], buffer.data());
+                file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            }
+        }
+        pad(file, offset);
+        if (!file.flush()) {
+            throw std::runtime_error("Cannot write output file: " + path);
+        }
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'P', 'T', 'S', 'C', 'O', 'L', 'S', '\0'};
+    static constexpr size_t HEADER_SIZE = 24;
+    static constexpr size_t NAME_SIZE = 16;
+    static constexpr size_t COLUMN_ENTRY_SIZE = NAME_SIZE + 16;
+    static constexpr size_t CHUNK = 65536;
+    static constexpr Type UNKNOWN_TYPE = static_cast<Type>(0);
+
+    static Type typeOf(const std::string& field) {
+        if (field == "x" || field == "y") return Type::Float64;
+        if (field == "id" || field == "group_id") return Type::Int64;
+        if (field == "category") return Type::Int32;
+        return UNKNOWN_TYPE;
+    }
+
+    static uint32_t sizeOf(Type type) {
+        return type == Type::Int32 ? 4 : 8;
+    }
+
+    // Writes field of points [begin, end) to out: IEEE 754 bits for doubles,
+    // two's complement for integers. The field is resolved once per chunk.
+    template <typename Point>
+    static void encode(const std::vector<Point>& points, size_t begin, size_t end, const std::string& field, char* out) {
+        if (field == "x" || field == "y") {
+            bool x = field == "x";
+            for (size_t i = begin; i < end; ++i, out += 8) {
+                double value = x ? points[i].x : points[i].y;
+                uint64_t raw;
+                std::memcpy(&raw, &value, sizeof(raw));
+                putLE(out, raw, 8);
+            }
+        } else if (field == "id" || field == "group_id") {
+            bool id = field == "id";
+            for (size_t i = begin; i < end; ++i, out += 8) {
+                int64_t value = id ? points[i].id : points[i].group_id;
+                putLE(out, static_cast<uint64_t>(value), 8);
+            }
+        } else {
+            for (size_t i = begin; i < end; ++i, out += 4) {
+                putLE(out, static_cast<uint32_t>(static_cast<int32_t>(points[i].category)), 4);
+            }
+        }
+    }
+
+    // Byte by byte, so the file is little-endian on any host; compilers turn
+    // this into a plain store on little-endian ones
+    static void putLE(char* out, uint64_t value, size_t bytes) {
+        for (size_t b = 0; b < bytes; ++b) {
+            out[b] = static_cast<char>((value >> (8 * b)) & 0xFF);
+        }
+    }
+
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    static void pad(std::ofstream& file, uint64_t offset) {
+        static const char zeros[ALIGNMENT] = {};
+        uint64_t position = static_cast<uint64_t>(file.tellp());
+        if (position < offset) {
+            file.write(zeros, static_cast<std::streamsize>(offset - position));
+        }
+    }
+};
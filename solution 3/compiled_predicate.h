@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "group_bounds_index.h"
+#include "morsel_executor.h"
+#include "query_tree.h"
+#include "region_store.h"
+
+// Whole operator tree compiled into one per-point predicate over a RegionStore.
+// Every crop becomes a branch instruction that jumps to another instruction or
+// to ACCEPT/REJECT depending on the outcome, so AND/OR short-circuit per point
+// without materializing any intermediate set. Group filters and proper-group
+// checks are precomputed as bitsets over dense group indices.
+class CompiledPredicate {
+public:
+    CompiledPredicate(const QueryTree& tree, const RegionStore& store)
+        : store_(store) {
+        entry_ = compile(tree, tree.root());
+    }
+
+    size_t leafCount() const { return program_.size(); }
+    size_t bitsetCount() const { return bitsets_.size(); }
+
+    bool matches(size_t row) const {
+        int pc = entry_;
+        while (pc >= 0) {
+            const Instruction& ins = program_[pc];
+            pc = testLeaf(ins, row) ? ins.on_true : ins.on_false;
+        }
+        return pc == ACCEPT;
+    }
+
+    // Single parallel pass over the store. Rows come back in storage order.
+    std::vector<size_t> scan(const MorselExecutor& executor = MorselExecutor()) const {
+        if (entry_ < 0) {
+            std::vector<size_t> all(entry_ == ACCEPT ? store_.size() : 0);
+            for (size_t i = 0; i < all.size(); ++i) all[i] = i;
+            return all;
+        }
+        return executor.select(store_.size(), [this](size_t begin, size_t end, size_t* out) {
+            size_t kept = 0;
+            for (size_t row = begin; row < end; ++row) {
+                out[kept] = row;
+                kept += matches(row);
+            }
+            return kept;
+        });
+    }
+
+    // Same as scan() restricted to candidate rows (e.g. from a spatial index);
+    // matching rows keep their order in candidates
+    std::vector<size_t> filter(const std::vector<size_t>& candidates,
+                               const MorselExecutor& executor = MorselExecutor()) const {
+        if (entry_ < 0) {
+            return entry_ == ACCEPT ? candidates : std::vector<size_t>();
+        }
+        std::vector<size_t> positions = executor.select(candidates.size(), [this, &candidates](size_t begin, size_t end, size_t* out) {
+            size_t kept = 0;
+            for (size_t i = begin; i < end; ++i) {
+                out[kept] = i;
+                kept += matches(candidates[i]);
+            }
+            return kept;
+        });
+        for (size_t& position : positions) position = candidates[position];
+        return positions;
+    }
+
+    // Number of candidates that match, without building the selection: every
+    // 64 candidates become one mask word, which is popcounted
+    size_t count(const std::vector<size_t>& candidates, const MorselExecutor& executor = MorselExecutor()) const {
+        if (entry_ < 0) {
+            return entry_ == ACCEPT ? candidates.size() : 0;
+        }
+        std::atomic<size_t> total(0);
+        executor.select(candidates.size(), [this, &candidates, &total](size_t begin, size_t end, size_t*) {
+            size_t matched = 0;
+            for (size_t word = begin; word < end; word += 64) {
+                uint64_t mask = 0;
+                for (size_t i = word, last = std::min(end, word + 64); i < last; ++i) {
+                    mask |= uint64_t(matches(candidates[i])) << (i - word);
+                }
+                matched += __builtin_popcountll(mask);
+            }
+            total += matched;
+            return size_t(0);   // nothing selected, only counted
+        });
+        return total;
+    }
+
+private:
+    static constexpr int ACCEPT = -1;
+    static constexpr int REJECT = -2;
+
+    struct Instruction {
+        Region region;
+        int category;
+        bool has_category;
+        int groups_bitset;   // index into bitsets_, -1 when unused
+        int proper_bitset;   // index into bitsets_, -1 when unused
+        int on_true;
+        int on_false;
+    };
+
+    using Bitset = std::vector<uint64_t>;
+
+    const RegionStore& store_;
+    std::vector<Instruction> program_;
+    std::vector<Bitset> bitsets_;
+    std::map<std::vector<double>, int> proper_bitset_by_region_;
+    std::unique_ptr<GroupBoundsIndex> group_index_;   // built on the first proper crop
+    int entry_;
+
+    static bool testBit(const Bitset& bits, uint32_t index) {
+        return (bits[index >> 6] >> (index & 63)) & 1;
+    }
+
+    bool testLeaf(const Instruction& ins, size_t row) const {
+        double x = store_.xs()[row];
+        double y = store_.ys()[row];
+        if (x < ins.region.p_min_x || x > ins.region.p_max_x ||
+            y < ins.region.p_min_y || y > ins.region.p_max_y) {
+            return false;
+        }
+        if (ins.has_category && store_.categories()[row] != ins.category) {
+            return false;
+        }
+        uint32_t group = store_.groupIndices()[row];
+        if (ins.groups_bitset >= 0 && !testBit(bitsets_[ins.groups_bitset], group)) {
+            return false;
+        }
+        if (ins.proper_bitset >= 0 && !testBit(bitsets_[ins.proper_bitset], group)) {
+            return false;
+        }
+        return true;
+    }
+
+    // Emits code for the tree below root and returns the instruction to start
+    // at. An AND's operands fall through to the next one on success and an
+    // OR's on failure, so operands are compiled last to first, each once the
+    // code it continues to exists. Pending operators are kept on a stack.
+    int compile(const QueryTree& tree, NodeId root) {
+        struct Frame {
+            bool is_and;
+            QueryTree::Operands operands;
+            size_t remaining;   // operands [0, remaining) are not compiled yet
+            int on_true;
+            int on_false;
+            int next;           // start of the operand compiled last
+        };
+        std::vector<Frame> frames;
+        NodeId id = root;
+        int on_true = ACCEPT;
+        int on_false = REJECT;
+        while (true) {
+            int start = on_false;
+            bool done = std::visit(Overloaded{
+                [&](const CropNode& crop) {
+                    start = compileCrop(crop.params, on_true, on_false);
+                    return true;
+                },
+                [&](const AndNode& node) {
+                    auto operands = tree.operands(node.operands);
+                    if (operands.empty()) return true;
+                    frames.push_back({true, operands, operands.size(), on_true, on_false, on_true});
+                    return false;
+                },
+                [&](const OrNode& node) {
+                    auto operands = tree.operands(node.operands);
+                    frames.push_back({false, operands, operands.size(), on_true, on_false, on_false});
+                    return false;
+                },
+                [&](const EmptyNode&) {
+                    return true;
+                },
+            }, tree.node(id));
+
+            // An operator whose operands are all compiled starts at its first one
+            if (done) {
+                if (frames.empty()) return start;
+                frames.back().next = start;
+            }
+            while (frames.back().remaining == 0) {
+                start = frames.back().next;
+                frames.pop_back();
+                if (frames.empty()) return start;
+                frames.back().next = start;
+            }
+
+            Frame& frame = frames.back();
+            id = frame.operands[--frame.remaining];
+            on_true = frame.is_and ? frame.next : frame.on_true;
+            on_false = frame.is_and ? frame.on_false : frame.next;
+        }
+    }
+
+    int compileCrop(const CropParams& params, int on_true, int on_false) {
+        Instruction ins;
+        ins.region = params.region;
+        ins.category = params.category;
+        ins.has_category = params.has_category;
+        ins.groups_bitset = -1;
+        ins.proper_bitset = -1;
+        ins.on_true = on_true;
+        ins.on_false = on_false;
+
+        if (params.has_one_of_groups && !params.one_of_groups.empty()) {
+            Bitset bits((store_.groupCount() + 63) / 64, 0);
+            for (long group_id : params.one_of_groups) {
+                int64_t group = store_.findGroup(group_id);
+                if (group >= 0) bits[group >> 6] |= uint64_t(1) << (group & 63);
+            }
+            ins.groups_bitset = static_cast<int>(bitsets_.size());
+            bitsets_.push_back(std::move(bits));
+        }
+
+        if (params.proper) {
+            ins.proper_bitset = properBitset(params.region);
+        }
+
+        program_.push_back(ins);
+        return static_cast<int>(program_.size() - 1);
+    }
+
+    // Groups whose bounding box lies inside region, shared by every crop on the same region
+    int properBitset(const Region& region) {
+        std::vector<double> key = {region.p_min_x, region.p_min_y, region.p_max_x, region.p_max_y};
+        auto it = proper_bitset_by_region_.find(key);
+        if (it != proper_bitset_by_region_.end()) {
+            return it->second;
+        }
+
+        if (!group_index_) {
+            group_index_ = std::make_unique<GroupBoundsIndex>(store_);
+        }
+        Bitset bits((store_.groupCount() + 63) / 64, 0);
+        group_index_->contained(region, [&bits](uint32_t group) {
+            bits[group >> 6] |= uint64_t(1) << (group & 63);
+        });
+        int index = static_cast<int>(bitsets_.size());
+        bitsets_.push_back(std::move(bits));
+        proper_bitset_by_region_.emplace(key, index);
+        return index;
+    }
+};
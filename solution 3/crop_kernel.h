@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "query_tree.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CROP_KERNEL_X86 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define CROP_KERNEL_NEON 1
+#endif
+
+// Rectangle (and optional category) test over SoA coordinate columns, the
+// innermost loop of an in-memory crop. Each kernel writes the positions of the
+// selected points to out, which must have room for count entries, and returns
+// how many it wrote. The SIMD kernels compare 2 (NEON), 4 (AVX2) or 8
+// (AVX-512) points per instruction into a selection mask and compact the
+// selected positions without branching on individual points. The x86 kernels
+// are compiled with per-function target attributes, so the binary needs no
+// -mavx flags and picks a kernel from the running CPU.
+class CropKernel {
+public:
+    struct Filter {
+        Region region;
+        bool has_category = false;
+        int category = 0;
+    };
+
+    using Function = size_t (*)(const double* xs, const double* ys, const int* categories, size_t count,
+                                const Filter& filter, size_t* out);
+
+    struct Isa {
+        const char* name;
+        Function select;
+    };
+
+    // Kernels this CPU can run, from the scalar fallback to the widest
+    static std::vector<Isa> available() {
+        std::vector<Isa> kernels = {{"scalar", &selectScalar}};
+#if CROP_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) kernels.push_back({"avx2", &selectAvx2});
+        if (__builtin_cpu_supports("avx512f")) kernels.push_back({"avx512", &selectAvx512});
+#endif
+#if CROP_KERNEL_NEON
+        kernels.push_back({"neon", &selectNeon});
+#endif
+        return kernels;
+    }
+
+    static const Isa& best() {
+        static const Isa isa = available().back();
+        return isa;
+    }
+
+    static size_t select(const double* xs, const double* ys, const int* categories, size_t count,
+                         const Filter& filter, size_t* out) {
+        return best().select(xs, ys, categories, count, filter, out);
+    }
+
+    static size_t selectScalar(const double* xs, const double* ys, const int* categories, size_t count,
+                               const Filter& filter, size_t* out) {
+        return tail(xs, ys, categories, 0, count, filter, out, 0);
+    }
+
+#if CROP_KERNEL_X86
+    __attribute__((target("avx2")))
+    static size_t selectAvx2(const double* xs, const double* ys, const int* categories, size_t count,
+                             const Filter& filter, size_t* out) {
+        const __m256d min_x = _mm256_set1_pd(filter.region.p_min_x);
+        const __m256d max_x = _mm256_set1_pd(filter.region.p_max_x);
+        const __m256d min_y = _mm256_set1_pd(filter.region.p_min_y);
+        const __m256d max_y = _mm256_set1_pd(filter.region.p_max_y);
+        const __m128i category = _mm_set1_epi32(filter.category);
+
+        size_t selected = 0;
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m256d x = _mm256_loadu_pd(xs + i);
+            __m256d y = _mm256_loadu_pd(ys + i);
+            __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, min_x, _CMP_GE_OQ), _mm256_cmp_pd(x, max_x, _CMP_LE_OQ)),
+                                           _mm256_and_pd(_mm256_cmp_pd(y, min_y, _CMP_GE_OQ), _mm256_cmp_pd(y, max_y, _CMP_LE_OQ)));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(inside));
+            if (filter.has_category) {
+                __m128i same = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(categories + i)), category);
+                mask &= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(same)));
+            }
+            // Write every lane's position and advance only past the selected ones
+            out[selected] = i;
+            selected += mask & 1;
+            out[selected] = i + 1;
+            selected += (mask >> 1) & 1;
+            out[selected] = i + 2;
+            selected += (mask >> 2) & 1;
+            out[selected] = i + 3;
+            selected += (mask >> 3) & 1;
+        }
+        return tail(xs, ys, categories, i, count, filter, out, selected);
+    }
+
+    __attribute__((target("avx512f")))
+    static size_t selectAvx512(const double* xs, const double* ys, const int* categories, size_t count,
+                               const Filter& filter, size_t* out) {
+        const __m512d min_x = _mm512_set1_pd(filter.region.p_min_x);
+        const __m512d max_x = _mm512_set1_pd(filter.region.p_max_x);
+        const __m512d min_y = _mm512_set1_pd(filter.region.p_min_y);
+        const __m512d max_y = _mm512_set1_pd(filter.region.p_max_y);
+        const __m512i category = _mm512_set1_epi64(filter.category);
+        const __m512i lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+
+        size_t selected = 0;
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m512d x = _mm512_loadu_pd(xs + i);
+            __m512d y = _mm512_loadu_pd(ys + i);
+            __mmask8 mask = _mm512_cmp_pd_mask(x, min_x, _CMP_GE_OQ);
+            mask = _mm512_mask_cmp_pd_mask(mask, x, max_x, _CMP_LE_OQ);
+            mask = _mm512_mask_cmp_pd_mask(mask, y, min_y, _CMP_GE_OQ);
+            mask = _mm512_mask_cmp_pd_mask(mask, y, max_y, _CMP_LE_OQ);
+            if (filter.has_category) {
+                __m512i values = _mm512_maskz_cvtepi32_epi64(0xFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(categories + i)));
+                mask = _mm512_mask_cmpeq_epi64_mask(mask, values, category);
+            }
+            // Compress the selected lanes' positions into consecutive slots
+            __m512i positions = _mm512_add_epi64(_mm512_set1_epi64(static_cast<long long>(i)), lanes);
+            _mm512_mask_compressstoreu_epi64(out + selected, mask, positions);
+            selected += static_cast<size_t>(__builtin_popcount(mask));
+        }
+        return tail(xs, ys, categories, i, count, filter, out, selected);
+    }
+#endif
+
+#if CROP_KERNEL_NEON
+    static size_t selectNeon(const double* xs, const double* ys, const int* categories, size_t count,
+                             const Filter& filter, size_t* out) {
+        const float64x2_t min_x = vdupq_n_f64(filter.region.p_min_x);
+        const float64x2_t max_x = vdupq_n_f64(filter.region.p_max_x);
+        const float64x2_t min_y = vdupq_n_f64(filter.region.p_min_y);
+        const float64x2_t max_y = vdupq_n_f64(filter.region.p_max_y);
+
+        size_t selected = 0;
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            float64x2_t x = vld1q_f64(xs + i);
+            float64x2_t y = vld1q_f64(ys + i);
+            uint64x2_t inside = vandq_u64(vandq_u64(vcgeq_f64(x, min_x), vcleq_f64(x, max_x)),
+                                          vandq_u64(vcgeq_f64(y, min_y), vcleq_f64(y, max_y)));
+            size_t first = vgetq_lane_u64(inside, 0) & 1;
+            size_t second = vgetq_lane_u64(inside, 1) & 1;
+            if (filter.has_category) {
+                first &= categories[i] == filter.category;
+                second &= categories[i + 1] == filter.category;
+            }
+            out[selected] = i;
+            selected += first;
+            out[selected] = i + 1;
+            selected += second;
+        }
+        return tail(xs, ys, categories, i, count, filter, out, selected);
+    }
+#endif
+
+private:
+    // Scalar loop over [begin, count), also used for the lanes left over by the SIMD kernels
+    static size_t tail(const double* xs, const double* ys, const int* categories, size_t begin, size_t count,
+                       const Filter& filter, size_t* out, size_t selected) {
+        const Region& region = filter.region;
+        for (size_t i = begin; i < count; ++i) {
+            bool inside = xs[i] >= region.p_min_x && xs[i] <= region.p_max_x &&
+                          ys[i] >= region.p_min_y && ys[i] <= region.p_max_y &&
+                          (!filter.has_category || categories[i] == filter.category);
+            out[selected] = i;
+            selected += inside;
+        }
+        return selected;
+    }
+};
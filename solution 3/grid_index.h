@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "query_tree.h"
+#include "region_store.h"
+
+// Uniform grid over the extent of a RegionStore with points stored sorted by
+// cell (row-major), so the points of a cell, and of a run of cells in one grid
+// row, are one contiguous SoA range. The cell size is derived from the point
+// count and extent to hold about TARGET_POINTS_PER_CELL points per cell on
+// uniform data. A crop emits the cells strictly inside it without looking at
+// their points and tests points only in the boundary cells.
+class GridIndex {
+public:
+    static constexpr double TARGET_POINTS_PER_CELL = 16.0;
+
+    explicit GridIndex(const RegionStore& store) {
+        size_t count = store.size();
+        if (count == 0) return;
+        if (count > UINT32_MAX) {
+            throw std::runtime_error("Too many regions for a grid index");
+        }
+
+        const auto& extent = store.extent();
+        min_x_ = extent.min_x;
+        min_y_ = extent.min_y;
+        double width = extent.max_x - min_x_;
+        double height = extent.max_y - min_y_;
+
+        // Square cells sized for the target occupancy; degenerate extents collapse to one row or column
+        double cells = std::max(1.0, std::min(double(MAX_CELLS), count / TARGET_POINTS_PER_CELL));
+        double area = std::max(width, 1e-300) * std::max(height, 1e-300);
+        double side = width > 0.0 && height > 0.0 ? std::sqrt(area / cells) : std::max(width, height) / cells;
+        if (!(side > 0.0)) side = 1.0;
+        columns_ = static_cast<size_t>(std::min(double(MAX_CELLS), std::floor(width / side) + 1));
+        rows_count_ = static_cast<size_t>(std::min(double(MAX_CELLS) / columns_, std::floor(height / side) + 1));
+        rows_count_ = std::max<size_t>(1, rows_count_);
+        inv_cell_width_ = columns_ / std::max(width, 1e-300) * (1.0 - 1e-12);
+        inv_cell_height_ = rows_count_ / std::max(height, 1e-300) * (1.0 - 1e-12);
+
+        // Counting sort of the points by cell
+        std::vector<uint32_t> cell_of(count);
+        offsets_.assign(columns_ * rows_count_ + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            size_t cell = clampedRow(store.ys()[i]) * columns_ + clampedColumn(store.xs()[i]);
+            cell_of[i] = static_cast<uint32_t>(cell);
+            ++offsets_[cell + 1];
+        }
+        for (size_t cell = 0; cell + 1 < offsets_.size(); ++cell) {
+            offsets_[cell + 1] += offsets_[cell];
+        }
+
+        std::vector<uint32_t> next(offsets_.begin(), offsets_.end() - 1);
+        xs_.resize(count);
+        ys_.resize(count);
+        rows_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t slot = next[cell_of[i]]++;
+            xs_[slot] = store.xs()[i];
+            ys_[slot] = store.ys()[i];
+            rows_[slot] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // Rough cost of building the grid over store, in row tests: one pass
+    // finding every point's cell and one placing it
+    static double buildCost(const RegionStore& store) {
+        return 2.0 * static_cast<double>(store.size());
+    }
+
+    size_t size() const { return rows_.size(); }
+    size_t columns() const { return columns_; }
+    size_t rows() const { return rows_count_; }
+
+    // Calls emit(row) for every store row inside region (bounds inclusive, like BETWEEN)
+    template <typename Emit>
+    void crop(const Region& region, Emit emit) const {
+        if (rows_.empty() || region.p_min_x > region.p_max_x || region.p_min_y > region.p_max_y) return;
+
+        // Cell coordinates of the corners, one step outside the grid when beyond it.
+        // Points are binned with the same monotone function, so any cell strictly
+        // between the corner cells only holds points strictly inside the region.
+        long first_column = cellCoordinate((region.p_min_x - min_x_) * inv_cell_width_, columns_);
+        long last_column = cellCoordinate((region.p_max_x - min_x_) * inv_cell_width_, columns_);
+        long first_row = cellCoordinate((region.p_min_y - min_y_) * inv_cell_height_, rows_count_);
+        long last_row = cellCoordinate((region.p_max_y - min_y_) * inv_cell_height_, rows_count_);
+
+        long column_begin = std::max(0L, first_column);
+        long column_end = std::min(static_cast<long>(columns_) - 1, last_column);
+        long row_begin = std::max(0L, first_row);
+        long row_end = std::min(static_cast<long>(rows_count_) - 1, last_row);
+
+        for (long row = row_begin; row <= row_end; ++row) {
+            size_t row_offset = static_cast<size_t>(row) * columns_;
+            bool row_inside = row > first_row && row < last_row;
+            long inner_begin = std::max(column_begin, first_column + 1);
+            long inner_end = std::min(column_end, last_column - 1);
+
+            if (row_inside && inner_begin <= inner_end) {
+                testCells(region, row_offset + column_begin, row_offset + inner_begin, emit);
+                for (uint32_t i = offsets_[row_offset + inner_begin]; i < offsets_[row_offset + inner_end + 1]; ++i) {
+                    emit(rows_[i]);
+                }
+                testCells(region, row_offset + inner_end + 1, row_offset + column_end + 1, emit);
+            } else {
+                testCells(region, row_offset + column_begin, row_offset + column_end + 1, emit);
+            }
+        }
+    }
+
+    std::vector<size_t> crop(const Region& region) const {
+        std::vector<size_t> rows;
+        crop(region, [&rows](uint32_t row) { rows.push_back(row); });
+        return rows;
+    }
+
+private:
+    static constexpr size_t MAX_CELLS = size_t(1) << 26;
+
+    double min_x_ = 0.0;
+    double min_y_ = 0.0;
+    double inv_cell_width_ = 0.0;
+    double inv_cell_height_ = 0.0;
+    size_t columns_ = 0;
+    size_t rows_count_ = 0;
+
+    std::vector<uint32_t> offsets_;   // points of cell c are [offsets_[c], offsets_[c + 1])
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+    std::vector<uint32_t> rows_;
+
+    static long cellCoordinate(double scaled, size_t cells) {
+        if (scaled < 0.0) return -1;
+        if (scaled >= static_cast<double>(cells)) return static_cast<long>(cells);
+        return static_cast<long>(scaled);
+    }
+
+    size_t clampedColumn(double x) const {
+        long column = cellCoordinate((x - min_x_) * inv_cell_width_, columns_);
+        return static_cast<size_t>(std::min(std::max(column, 0L), static_cast<long>(columns_) - 1));
+    }
+
+    size_t clampedRow(double y) const {
+        long row = cellCoordinate((y - min_y_) * inv_cell_height_, rows_count_);
+        return static_cast<size_t>(std::min(std::max(row, 0L), static_cast<long>(rows_count_) - 1));
+    }
+
+    // Tests every point of the cells [first_cell, end_cell) against region
+    template <typename Emit>
+    void testCells(const Region& region, size_t first_cell, size_t end_cell, Emit& emit) const {
+        if (first_cell >= end_cell) return;
+        for (uint32_t i = offsets_[first_cell]; i < offsets_[end_cell]; ++i) {
+            if (xs_[i] >= region.p_min_x && xs_[i] <= region.p_max_x &&
+                ys_[i] >= region.p_min_y && ys_[i] <= region.p_max_y) {
+                emit(rows_[i]);
+            }
+        }
+    }
+};
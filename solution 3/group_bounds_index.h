@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "query_tree.h"
+#include "region_store.h"
+
+// Finds the groups whose bounding box lies inside a rectangle, the candidates
+// of a proper crop. A box is inside [a, b] x [c, d] when min_x >= a,
+// min_y >= c, max_x <= b and max_y <= d, so mapping each box to the 4D point
+// (min_x, min_y, -max_x, -max_y) turns the test into a dominance query: every
+// coordinate >= (a, c, -b, -d). The points go into a static implicit KD-tree
+// cycling through the four dimensions, with a per-node bounding box used to
+// skip subtrees that fail any dimension and to report whole subtrees that
+// pass all of them.
+class GroupBoundsIndex {
+public:
+    explicit GroupBoundsIndex(const RegionStore& store) {
+        size_t count = store.groupCount();
+        entries_.resize(count);
+        for (uint32_t group = 0; group < count; ++group) {
+            const auto& bounds = store.groupBounds(group);
+            entries_[group] = {{bounds.min_x, bounds.min_y, -bounds.max_x, -bounds.max_y}, group};
+        }
+
+        levels_ = 0;
+        while ((count >> levels_) > LEAF_SIZE) ++levels_;
+        low_.resize((size_t(2) << levels_) - 1);
+        high_.resize(low_.size());
+        if (count > 0) build(0, 0, count, 0);
+    }
+
+    size_t size() const { return entries_.size(); }
+
+    // Calls emit(group_index) for every group whose bounding box lies inside region
+    template <typename Emit>
+    void contained(const Region& region, Emit emit) const {
+        if (entries_.empty()) return;
+        const Point query = {region.p_min_x, region.p_min_y, -region.p_max_x, -region.p_max_y};
+
+        struct Pending {
+            size_t node;
+            size_t begin;
+            size_t end;
+        };
+        Pending stack[2 * 64];
+        size_t top = 0;
+        stack[top++] = {0, 0, entries_.size()};
+        size_t first_leaf = (size_t(1) << levels_) - 1;
+
+        while (top > 0) {
+            Pending current = stack[--top];
+            if (!dominates(high_[current.node], query)) continue;
+            if (dominates(low_[current.node], query)) {
+                for (size_t i = current.begin; i < current.end; ++i) emit(entries_[i].group);
+                continue;
+            }
+            if (current.node >= first_leaf) {
+                for (size_t i = current.begin; i < current.end; ++i) {
+                    if (dominates(entries_[i].point, query)) emit(entries_[i].group);
+                }
+                continue;
+            }
+            size_t mid = current.begin + (current.end - current.begin) / 2;
+            stack[top++] = {2 * current.node + 2, mid, current.end};
+            stack[top++] = {2 * current.node + 1, current.begin, mid};
+        }
+    }
+
+private:
+    static constexpr size_t LEAF_SIZE = 32;
+
+    using Point = std::array<double, 4>;
+
+    struct Entry {
+        Point point;
+        uint32_t group;
+    };
+
+    // Group bounding boxes in tree order
+    std::vector<Entry> entries_;
+
+    // Per-node lower and upper corner over all four dimensions
+    std::vector<Point> low_;
+    std::vector<Point> high_;
+    int levels_ = 0;
+
+    static bool dominates(const Point& point, const Point& query) {
+        return point[0] >= query[0] && point[1] >= query[1] && point[2] >= query[2] && point[3] >= query[3];
+    }
+
+    void build(size_t node, size_t begin, size_t end, int depth) {
+        if (depth < levels_) {
+            size_t mid = begin + (end - begin) / 2;
+            int dimension = depth % 4;
+            std::nth_element(entries_.begin() + begin, entries_.begin() + mid, entries_.begin() + end,
+                             [dimension](const Entry& a, const Entry& b) { return a.point[dimension] < b.point[dimension]; });
+
+            build(2 * node + 1, begin, mid, depth + 1);
+            build(2 * node + 2, mid, end, depth + 1);
+            for (int d = 0; d < 4; ++d) {
+                low_[node][d] = std::min(low_[2 * node + 1][d], low_[2 * node + 2][d]);
+                high_[node][d] = std::max(high_[2 * node + 1][d], high_[2 * node + 2][d]);
+            }
+            return;
+        }
+
+        low_[node] = entries_[begin].point;
+        high_[node] = entries_[begin].point;
+        for (size_t i = begin + 1; i < end; ++i) {
+            for (int d = 0; d < 4; ++d) {
+                low_[node][d] = std::min(low_[node][d], entries_[i].point[d]);
+                high_[node][d] = std::max(high_[node][d], entries_[i].point[d]);
+            }
+        }
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Position of a point along a Hilbert curve filling a 2^16 x 2^16 grid laid
+// over an extent. Rows stored in key order are clustered in space, and a
+// crop's rectangle maps to a few key ranges: every aligned square of the
+// grid is one contiguous run of keys, so the rectangle is covered by a
+// quadtree decomposition whose squares become ranges. Cells are computed the
+// same way for points and rectangles and the mapping is monotone, so every
+// point inside a rectangle has a key inside one of its ranges (points outside
+// the extent are clamped to the border cells).
+class HilbertKey {
+public:
+    static constexpr uint32_t CURVE_SIDE = 1u << 16;
+
+    using Range = std::pair<uint64_t, uint64_t>;   // inclusive
+
+    HilbertKey() = default;
+
+    HilbertKey(double min_x, double min_y, double max_x, double max_y)
+        : min_x_(min_x), min_y_(min_y), max_x_(max_x), max_y_(max_y),
+          scale_x_(max_x > min_x ? (CURVE_SIDE - 1) / (max_x - min_x) : 0.0),
+          scale_y_(max_y > min_y ? (CURVE_SIDE - 1) / (max_y - min_y) : 0.0) {}
+
+    double minX() const { return min_x_; }
+    double minY() const { return min_y_; }
+    double maxX() const { return max_x_; }
+    double maxY() const { return max_y_; }
+
+    uint64_t key(double x, double y) const {
+        return index(cell(x, min_x_, scale_x_), cell(y, min_y_, scale_y_));
+    }
+
+    // Sorted, disjoint key ranges holding every key of a point inside the
+    // rectangle [min_x, max_x] x [min_y, max_y]. Squares cut by the rectangle
+    // are split level by level while the count stays within max_ranges; the
+    // ones left over are covered whole.
+    std::vector<Range> ranges(double min_x, double min_y, double max_x, double max_y, size_t max_ranges = 32) const {
+        if (!(min_x <= max_x) || !(min_y <= max_y)) {
+            return {};
+        }
+        uint32_t x0 = cell(min_x, min_x_, scale_x_);
+        uint32_t x1 = cell(max_x, min_x_, scale_x_);
+        uint32_t y0 = cell(min_y, min_y_, scale_y_);
+        uint32_t y1 = cell(max_y, min_y_, scale_y_);
+
+        std::vector<Range> ranges;
+        std::vector<Square> partial = {{0, 0, CURVE_SIDE}};
+        while (!partial.empty() && partial[0].side > 1 &&
+               ranges.size() + 4 * partial.size() <= max_ranges) {
+            std::vector<Square> next;
+            for (const Square& square : partial) {
+                uint32_t half = square.side / 2;
+                for (uint32_t q = 0; q < 4; ++q) {
+                    Square child = {square.x + (q & 1) * half, square.y + (q >> 1) * half, half};
+                    uint32_t cx1 = child.x + half - 1;
+                    uint32_t cy1 = child.y + half - 1;
+                    if (cx1 < x0 || child.x > x1 || cy1 < y0 || child.y > y1) {
+                        continue;
+                    }
+                    if (child.x >= x0 && cx1 <= x1 && child.y >= y0 && cy1 <= y1) {
+                        ranges.push_back(range(child));
+                    } else {
+                        next.push_back(child);
+                    }
+                }
+            }
+            partial.swap(next);
+        }
+        for (const Square& square : partial) {
+            ranges.push_back(range(square));
+        }
+
+        // Adjacent runs along the curve merge into one range
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<Range> merged;
+        for (const Range& r : ranges) {
+            if (!merged.empty() && r.first <= merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, r.second);
+            } else {
+                merged.push_back(r);
+            }
+        }
+        return merged;
+    }
+
+    // Distance of cell (x, y) along the Hilbert curve filling the CURVE_SIDE square
+    static uint64_t index(uint32_t x, uint32_t y) {
+        uint64_t index = 0;
+        for (uint32_t side = CURVE_SIDE / 2; side > 0; side /= 2) {
+            uint32_t rx = (x & side) ? 1 : 0;
+            uint32_t ry = (y & side) ? 1 : 0;
+            index += uint64_t(side) * side * ((3 * rx) ^ ry);
+            // Rotate the quadrant so the curve stays continuous
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = side - 1 - (x & (side - 1));
+                    y = side - 1 - (y & (side - 1));
+                }
+                std::swap(x, y);
+            }
+        }
+        return index;
+    }
+
+private:
+    struct Square {
+        uint32_t x, y, side;   // aligned: x and y are multiples of side
+    };
+
+    double min_x_ = 0.0;
+    double min_y_ = 0.0;
+    double max_x_ = 0.0;
+    double max_y_ = 0.0;
+    double scale_x_ = 0.0;
+    double scale_y_ = 0.0;
+
+    static uint32_t cell(double value, double origin, double scale) {
+        double steps = (value - origin) * scale;
+        if (!(steps > 0.0)) return 0;
+        if (steps >= CURVE_SIDE - 1) return CURVE_SIDE - 1;
+        return static_cast<uint32_t>(steps);
+    }
+
+    // Keys of an aligned square share everything above its low 2 * log2(side) bits
+    static Range range(const Square& square) {
+        uint64_t cells = uint64_t(square.side) * square.side;
+        uint64_t first = index(square.x, square.y) / cells * cells;
+        return {first, first + cells - 1};
+    }
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "hilbert_key.h"
+#include "query_tree.h"
+#include "region_store.h"
+
+// Static R-tree packed bottom-up from points sorted along a Hilbert curve.
+// Every node has exactly fanout children (the last one per level may have
+// fewer) and the children of node i are nodes i*fanout .. i*fanout+fanout-1 of
+// the level below, so the tree needs no pointers: each level is four SoA
+// arrays of bounding boxes and a node's children are one contiguous run that
+// the compiler can test with vector compares. Level 0 boxes cover fanout
+// points each; the points themselves are stored in Hilbert order.
+class HilbertRTree {
+public:
+    static constexpr size_t MIN_FANOUT = 16;
+    static constexpr size_t MAX_FANOUT = 64;
+
+    explicit HilbertRTree(const RegionStore& store, size_t fanout = 32) : fanout_(fanout) {
+        if (fanout < MIN_FANOUT || fanout > MAX_FANOUT) {
+            throw std::runtime_error("R-tree fanout must be between 16 and 64");
+        }
+        size_t count = store.size();
+        if (count == 0) return;
+        if (count > UINT32_MAX) {
+            throw std::runtime_error("Too many regions for an R-tree index");
+        }
+
+        const auto& extent = store.extent();
+        double min_x = extent.min_x;
+        double max_x = extent.max_x;
+        double min_y = extent.min_y;
+        double max_y = extent.max_y;
+        double scale_x = max_x > min_x ? (CURVE_SIDE - 1) / (max_x - min_x) : 0.0;
+        double scale_y = max_y > min_y ? (CURVE_SIDE - 1) / (max_y - min_y) : 0.0;
+
+        std::vector<std::pair<uint64_t, uint32_t>> order(count);
+        for (size_t i = 0; i < count; ++i) {
+            auto cell_x = static_cast<uint32_t>((store.xs()[i] - min_x) * scale_x);
+            auto cell_y = static_cast<uint32_t>((store.ys()[i] - min_y) * scale_y);
+            order[i] = {HilbertKey::index(cell_x, cell_y), static_cast<uint32_t>(i)};
+        }
+        std::sort(order.begin(), order.end());
+
+        xs_.resize(count);
+        ys_.resize(count);
+        rows_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            rows_[i] = order[i].second;
+            xs_[i] = store.xs()[rows_[i]];
+            ys_[i] = store.ys()[rows_[i]];
+        }
+
+        // Leaf boxes from the points, then each level from the one below
+        levels_.emplace_back();
+        Level& leaves = levels_.back();
+        for (size_t begin = 0; begin < count; begin += fanout_) {
+            size_t end = std::min(count, begin + fanout_);
+            leaves.min_x.push_back(*std::min_element(xs_.begin() + begin, xs_.begin() + end));
+            leaves.min_y.push_back(*std::min_element(ys_.begin() + begin, ys_.begin() + end));
+            leaves.max_x.push_back(*std::max_element(xs_.begin() + begin, xs_.begin() + end));
+            leaves.max_y.push_back(*std::max_element(ys_.begin() + begin, ys_.begin() + end));
+        }
+        while (levels_.back().size() > 1) {
+            const Level& below = levels_.back();
+            Level above;
+            for (size_t begin = 0; begin < below.size(); begin += fanout_) {
+                size_t end = std::min(below.size(), begin + fanout_);
+                above.min_x.push_back(*std::min_element(below.min_x.begin() + begin, below.min_x.begin() + end));
+                above.min_y.push_back(*std::min_element(below.min_y.begin() + begin, below.min_y.begin() + end));
+                above.max_x.push_back(*std::max_element(below.max_x.begin() + begin, below.max_x.begin() + end));
+                above.max_y.push_back(*std::max_element(below.max_y.begin() + begin, below.max_y.begin() + end));
+            }
+            levels_.push_back(std::move(above));
+        }
+
+        // Points covered by one node of each level
+        size_t span = fanout_;
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            spans_.push_back(span);
+            span = span > count ? span : span * fanout_;
+        }
+    }
+
+    // Rough cost of building the tree over store, in row tests: the sort
+    // along the curve, then one pass packing the points
+    static double buildCost(const RegionStore& store) {
+        double count = static_cast<double>(store.size());
+        return count * (std::log2(std::max(count, 2.0)) + 1.0);
+    }
+
+    size_t size() const { return rows_.size(); }
+    size_t fanout() const { return fanout_; }
+    size_t height() const { return levels_.size(); }
+
+    size_t nodeCount() const {
+        size_t count = 0;
+        for (const Level& level : levels_) count += level.size();
+        return count;
+    }
+
+    // Calls emit(row) for every store row inside region (bounds inclusive, like BETWEEN)
+    template <typename Emit>
+    void crop(const Region& region, Emit emit) const {
+        if (rows_.empty()) return;
+
+        struct Pending {
+            size_t level;
+            size_t node;
+        };
+        std::vector<Pending> stack = {{levels_.size() - 1, 0}};
+        uint8_t overlap[MAX_FANOUT];
+        uint8_t inside[MAX_FANOUT];
+
+        while (!stack.empty()) {
+            Pending current = stack.back();
+            stack.pop_back();
+            const Level& level = levels_[current.level];
+            if (!intersects(level, current.node, region)) continue;
+
+            if (current.level == 0) {
+                size_t begin = current.node * fanout_;
+                size_t end = std::min(rows_.size(), begin + fanout_);
+                for (size_t i = begin; i < end; ++i) {
+                    if (xs_[i] >= region.p_min_x && xs_[i] <= region.p_max_x &&
+                        ys_[i] >= region.p_min_y && ys_[i] <= region.p_max_y) {
+                        emit(rows_[i]);
+                    }
+                }
+                continue;
+            }
+
+            // Classify all children in one branch-free pass over the SoA boxes
+            const Level& children = levels_[current.level - 1];
+            size_t first = current.node * fanout_;
+            size_t count = std::min(children.size(), first + fanout_) - first;
+            const double* min_x = children.min_x.data() + first;
+            const double* min_y = children.min_y.data() + first;
+            const double* max_x = children.max_x.data() + first;
+            const double* max_y = children.max_y.data() + first;
+            for (size_t i = 0; i < count; ++i) {
+                overlap[i] = (max_x[i] >= region.p_min_x) & (min_x[i] <= region.p_max_x) &
+                             (max_y[i] >= region.p_min_y) & (min_y[i] <= region.p_max_y);
+                inside[i] = (min_x[i] >= region.p_min_x) & (max_x[i] <= region.p_max_x) &
+                            (min_y[i] >= region.p_min_y) & (max_y[i] <= region.p_max_y);
+            }
+
+            size_t span = spans_[current.level - 1];
+            for (size_t i = count; i-- > 0;) {
+                if (inside[i]) {
+                    size_t begin = (first + i) * span;
+                    size_t end = std::min(rows_.size(), begin + span);
+                    for (size_t p = begin; p < end; ++p) emit(rows_[p]);
+                } else if (overlap[i]) {
+                    stack.push_back({current.level - 1, first + i});
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> crop(const Region& region) const {
+        std::vector<size_t> rows;
+        crop(region, [&rows](uint32_t row) { rows.push_back(row); });
+        return rows;
+    }
+
+private:
+    // Points are mapped onto a 2^16 x 2^16 Hilbert curve
+    static constexpr uint32_t CURVE_SIDE = HilbertKey::CURVE_SIDE;
+
+    struct Level {
+        std::vector<double> min_x;
+        std::vector<double> min_y;
+        std::vector<double> max_x;
+        std::vector<double> max_y;
+
+        size_t size() const { return min_x.size(); }
+    };
+
+    size_t fanout_;
+    std::vector<Level> levels_;     // levels_[0] are the leaves, levels_.back() the root
+    std::vector<size_t> spans_;     // points under one node, per level
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+    std::vector<uint32_t> rows_;
+
+    static bool intersects(const Level& level, size_t node, const Region& region) {
+        return level.max_x[node] >= region.p_min_x && level.min_x[node] <= region.p_max_x &&
+               level.max_y[node] >= region.p_min_y && level.min_y[node] <= region.p_max_y;
+    }
+};
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "query_tree.h"
+#include "region_store.h"
+
+// Static, bulk-loaded KD-tree over the (x, y) coordinates of a RegionStore.
+// The tree is implicit and perfectly balanced: node i has children 2i+1 and
+// 2i+2, every split is at the median of its range alternating x / y, so node
+// ranges never need to be stored. Points are laid out in tree order as SoA
+// columns, which makes every leaf (and every subtree) a contiguous run.
+// Each node keeps its tight bounding box: subtrees outside a crop are skipped,
+// subtrees inside it are emitted without testing a single point, which gives
+// O(sqrt(N) + k) per crop.
+// Like RegionStore, the tree reads its arrays through Column views: over its
+// own vectors when built or loaded from an index file, or in place over a
+// mapped snapshot (see view()).
+class KdTree {
+public:
+    static constexpr size_t LEAF_SIZE = 64;
+
+    struct Columns {
+        // Node bounding boxes, indexed by implicit node number
+        Column<double> min_x;
+        Column<double> min_y;
+        Column<double> max_x;
+        Column<double> max_y;
+        // Points in tree order
+        Column<double> xs;
+        Column<double> ys;
+        Column<uint32_t> rows;
+    };
+
+    KdTree() = default;
+    KdTree(KdTree&&) = default;
+    KdTree& operator=(KdTree&&) = default;
+    KdTree(const KdTree&) = delete;
+    KdTree& operator=(const KdTree&) = delete;
+
+    // Tree over columns owned elsewhere, which must outlive it; nothing is copied
+    static KdTree view(const Columns& columns, int levels, uint64_t fingerprint) {
+        KdTree tree;
+        tree.columns_ = columns;
+        tree.levels_ = levels;
+        tree.fingerprint_ = fingerprint;
+        return tree;
+    }
+
+    const Columns& columns() const { return columns_; }
+
+    explicit KdTree(const RegionStore& store) : fingerprint_(fingerprint(store)) {
+        size_t count = store.size();
+        if (count > UINT32_MAX) {
+            throw std::runtime_error("Too many regions for a KD-tree index");
+        }
+
+        levels_ = 0;
+        while ((count >> levels_) > LEAF_SIZE) ++levels_;
+        size_t node_count = (size_t(2) << levels_) - 1;
+        min_x_.resize(node_count);
+        min_y_.resize(node_count);
+        max_x_.resize(node_count);
+        max_y_.resize(node_count);
+
+        std::vector<Entry> entries(count);
+        for (size_t i = 0; i < count; ++i) {
+            entries[i] = {store.xs()[i], store.ys()[i], static_cast<uint32_t>(i)};
+        }
+
+        // One thread per subtree at the top of the tree
+        size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        int parallel_depth = 0;
+        while ((size_t(1) << parallel_depth) < threads && (count >> parallel_depth) > MIN_POINTS_PER_THREAD) {
+            ++parallel_depth;
+        }
+        build(entries, 0, 0, count, 0, parallel_depth);
+
+        xs_.resize(count);
+        ys_.resize(count);
+        rows_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            xs_[i] = entries[i].x;
+            ys_[i] = entries[i].y;
+            rows_[i] = entries[i].row;
+        }
+        refreshColumns();
+    }
+
+    // Rough cost of building the tree over store, in row tests: a median
+    // partition of every row per level
+    static double buildCost(const RegionStore& store) {
+        double count = static_cast<double>(store.size());
+        return count * std::max(1.0, std::log2(std::max(count, 2.0) / LEAF_SIZE));
+    }
+
+    size_t size() const { return columns_.rows.size(); }
+    size_t nodeCount() const { return columns_.min_x.size(); }
+    int levels() const { return levels_; }
+    // Fingerprint of the store the tree was built from
+    uint64_t sourceFingerprint() const { return fingerprint_; }
+
+    // Calls emit(row) for every store row inside region (bounds inclusive, like BETWEEN)
+    template <typename Emit>
+    void crop(const Region& region, Emit emit) const {
+        const Columns& c = columns_;
+        if (c.rows.empty()) return;
+
+        struct Pending {
+            size_t node;
+            size_t begin;
+            size_t end;
+        };
+        Pending stack[2 * 64];
+        size_t top = 0;
+        stack[top++] = {0, 0, c.rows.size()};
+        size_t first_leaf = (size_t(1) << levels_) - 1;
+
+        while (top > 0) {
+            Pending current = stack[--top];
+            size_t node = current.node;
+            if (c.max_x[node] < region.p_min_x || c.min_x[node] > region.p_max_x ||
+                c.max_y[node] < region.p_min_y || c.min_y[node] > region.p_max_y) {
+                continue;
+            }
+            if (c.min_x[node] >= region.p_min_x && c.max_x[node] <= region.p_max_x &&
+                c.min_y[node] >= region.p_min_y && c.max_y[node] <= region.p_max_y) {
+                for (size_t i = current.begin; i < current.end; ++i) emit(c.rows[i]);
+                continue;
+            }
+            if (node >= first_leaf) {
+                for (size_t i = current.begin; i < current.end; ++i) {
+                    if (c.xs[i] >= region.p_min_x && c.xs[i] <= region.p_max_x &&
+                        c.ys[i] >= region.p_min_y && c.ys[i] <= region.p_max_y) {
+                        emit(c.rows[i]);
+                    }
+                }
+                continue;
+            }
+            size_t mid = current.begin + (current.end - current.begin) / 2;
+            stack[top++] = {2 * node + 2, mid, current.end};
+            stack[top++] = {2 * node + 1, current.begin, mid};
+        }
+    }
+
+    std::vector<size_t> crop(const Region& region) const {
+        std::vector<size_t> rows;
+        crop(region, [&rows](uint32_t row) { rows.push_back(row); });
+        return rows;
+    }
+
+    // Identifies the store an index was built from, so a saved index is never
+    // used against different data
+    static uint64_t fingerprint(const RegionStore& store) {
+        uint64_t hash = FNV_OFFSET;
+        auto mix = [&hash](const void* data, size_t bytes) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < bytes; ++i) {
+                hash = (hash ^ p[i]) * FNV_PRIME;
+            }
+        };
+        uint64_t count = store.size();
+        mix(&count, sizeof(count));
+        for (size_t i = 0; i < store.size(); ++i) {
+            mix(&store.ids()[i], sizeof(long));
+            mix(&store.xs()[i], sizeof(double));
+            mix(&store.ys()[i], sizeof(double));
+        }
+        return hash;
+    }
+
+    // Native byte order; the file is a cache for this machine, not an exchange format
+    void save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot write index file: " + path);
+        }
+        uint32_t version = VERSION;
+        uint32_t levels = static_cast<uint32_t>(levels_);
+        uint64_t count = size();
+        file.write(MAGIC, sizeof(MAGIC));
+        write(file, &version, 1);
+        write(file, &levels, 1);
+        write(file, &count, 1);
+        write(file, &fingerprint_, 1);
+        write(file, columns_.min_x.data(), columns_.min_x.size());
+        write(file, columns_.min_y.data(), columns_.min_y.size());
+        write(file, columns_.max_x.data(), columns_.max_x.size());
+        write(file, columns_.max_y.data(), columns_.max_y.size());
+        write(file, columns_.xs.data(), columns_.xs.size());
+        write(file, columns_.ys.data(), columns_.ys.size());
+        write(file, columns_.rows.data(), columns_.rows.size());
+        if (!file) {
+            throw std::runtime_error("Cannot write index file: " + path);
+        }
+    }
+
+    // Throws when the file is unreadable, from another version or built from other data
+    static KdTree load(const std::string& path, const RegionStore& store) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open index file: " + path);
+        }
+
+        char magic[sizeof(MAGIC)];
+        uint32_t version = 0, levels = 0;
+        uint64_t count = 0;
+        KdTree tree;
+        file.read(magic, sizeof(magic));
+        read(file, &version, 1);
+        read(file, &levels, 1);
+        read(file, &count, 1);
+        read(file, &tree.fingerprint_, 1);
+        if (!file || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION || levels >= 32) {
+            throw std::runtime_error("Not a KD-tree index file: " + path);
+        }
+        if (count != store.size() || tree.fingerprint_ != fingerprint(store)) {
+            throw std::runtime_error("Index file was built from different regions: " + path);
+        }
+
+        tree.levels_ = static_cast<int>(levels);
+        size_t node_count = (size_t(2) << levels) - 1;
+        tree.min_x_.resize(node_count);
+        tree.min_y_.resize(node_count);
+        tree.max_x_.resize(node_count);
+        tree.max_y_.resize(node_count);
+        tree.xs_.resize(count);
+        tree.ys_.resize(count);
+        tree.rows_.resize(count);
+        read(file, tree.min_x_.data(), node_count);
+        read(file, tree.min_y_.data(), node_count);
+        read(file, tree.max_x_.data(), node_count);
+        read(file, tree.max_y_.data(), node_count);
+        read(file, tree.xs_.data(), count);
+        read(file, tree.ys_.data(), count);
+        read(file, tree.rows_.data(), count);
+        if (!file) {
+            throw std::runtime_error("Truncated index file: " + path);
+        }
+        tree.refreshColumns();
+        return tree;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'K', 'D', 'T', 'R', 'E', 'E', '\0', '\0'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t MIN_POINTS_PER_THREAD = 65536;
+    static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+    static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+    // Empty leaves get an inverted box so every crop skips them
+    static constexpr double HUGE_BOX = 1e308;
+
+    struct Entry {
+        double x;
+        double y;
+        uint32_t row;
+    };
+
+    Columns columns_;
+    int levels_ = 0;
+    uint64_t fingerprint_ = 0;
+
+    // Owned storage behind columns_ for built and loaded trees
+    std::vector<double> min_x_;
+    std::vector<double> min_y_;
+    std::vector<double> max_x_;
+    std::vector<double> max_y_;
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+    std::vector<uint32_t> rows_;
+
+    void refreshColumns() {
+        columns_.min_x = {min_x_.data(), min_x_.size()};
+        columns_.min_y = {min_y_.data(), min_y_.size()};
+        columns_.max_x = {max_x_.data(), max_x_.size()};
+        columns_.max_y = {max_y_.data(), max_y_.size()};
+        columns_.xs = {xs_.data(), xs_.size()};
+        columns_.ys = {ys_.data(), ys_.size()};
+        columns_.rows = {rows_.data(), rows_.size()};
+    }
+
+    void build(std::vector<Entry>& entries, size_t node, size_t begin, size_t end, int depth, int parallel_depth) {
+        if (depth == levels_) {
+            double min_x = HUGE_BOX, min_y = HUGE_BOX, max_x = -HUGE_BOX, max_y = -HUGE_BOX;
+            for (size_t i = begin; i < end; ++i) {
+                min_x = std::min(min_x, entries[i].x);
+                min_y = std::min(min_y, entries[i].y);
+                max_x = std::max(max_x, entries[i].x);
+                max_y = std::max(max_y, entries[i].y);
+            }
+            min_x_[node] = min_x;
+            min_y_[node] = min_y;
+            max_x_[node] = max_x;
+            max_y_[node] = max_y;
+            return;
+        }
+
+        size_t mid = begin + (end - begin) / 2;
+        bool by_x = depth % 2 == 0;
+        std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end,
+                         [by_x](const Entry& a, const Entry& b) { return by_x ? a.x < b.x : a.y < b.y; });
+
+        size_t left = 2 * node + 1;
+        size_t right = 2 * node + 2;
+        if (depth < parallel_depth) {
+            std::thread worker([&]() { build(entries, left, begin, mid, depth + 1, parallel_depth); });
+            build(entries, right, mid, end, depth + 1, parallel_depth);
+            worker.join();
+        } else {
+            build(entries, left, begin, mid, depth + 1, parallel_depth);
+            build(entries, right, mid, end, depth + 1, parallel_depth);
+        }
+
+        min_x_[node] = std::min(min_x_[left], min_x_[right]);
+        min_y_[node] = std::min(min_y_[left], min_y_[right]);
+        max_x_[node] = std::max(max_x_[left], max_x_[right]);
+        max_y_[node] = std::max(max_y_[left], max_y_[right]);
+    }
+
+    template <typename T>
+    static void write(std::ofstream& file, const T* data, size_t count) {
+        file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+    }
+
+    template <typename T>
+    static void read(std::ifstream& file, T* data, size_t count) {
+        file.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+    }
+};
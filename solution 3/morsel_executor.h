@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Morsel-driven parallel selection over the positions [0, count). The range
+// is cut into morsels of MORSEL_SIZE positions (about 300 KiB of coordinate
+// and category columns, so a morsel stays in L2 while it is tested). Each
+// worker starts with an equal contiguous share of the morsels and takes them
+// from the front; a worker that runs dry steals the back half of the largest
+// remaining share, so skewed morsels (dense crops, expensive predicates) do
+// not leave threads idle. Workers append to their own selection vector and
+// note which morsel each piece came from; the merge lays the pieces out in
+// morsel order, so the result is in position order as a serial scan's would be.
+class MorselExecutor {
+public:
+    static constexpr size_t MORSEL_SIZE = 16384;
+
+    // threads == 0 uses every hardware thread
+    explicit MorselExecutor(size_t threads = 0, size_t morsel_size = MORSEL_SIZE)
+        : threads_(threads > 0 ? threads : std::max<size_t>(1, std::thread::hardware_concurrency())),
+          morsel_size_(std::max<size_t>(1, morsel_size)) {}
+
+    size_t threads() const { return threads_; }
+    size_t morselSize() const { return morsel_size_; }
+
+    // Calls select(begin, end, out) for every morsel [begin, end); select
+    // writes the positions it keeps, in order, to out (room for end - begin
+    // entries) and returns how many it wrote. Returns all kept positions in
+    // ascending order.
+    template <typename Select>
+    std::vector<size_t> select(size_t count, Select select) const {
+        size_t morsels = (count + morsel_size_ - 1) / morsel_size_;
+        size_t workers = std::max<size_t>(1, std::min(threads_, morsels));
+
+        // Share of worker t is [begin, end) of morsel numbers, packed in one word
+        std::unique_ptr<std::atomic<uint64_t>[]> shares(new std::atomic<uint64_t>[workers]);
+        for (size_t t = 0; t < workers; ++t) {
+            shares[t].store(pack(morsels * t / workers, morsels * (t + 1) / workers));
+        }
+
+        std::vector<Local> locals(workers);
+        auto work = [&](size_t t) {
+            Local& local = locals[t];
+            uint64_t morsel;
+            while (next(shares.get(), workers, t, morsel)) {
+                size_t begin = morsel * morsel_size_;
+                size_t end = std::min(count, begin + morsel_size_);
+                if (local.rows.size() < local.used + (end - begin)) {
+                    local.rows.resize(std::max(2 * local.rows.size(), local.used + (end - begin)));
+                }
+                size_t kept = select(begin, end, local.rows.data() + local.used);
+                local.pieces.push_back({morsel, local.used, kept});
+                local.used += kept;
+            }
+        };
+
+        // One worker runs on the calling thread and its pieces are already in order
+        if (workers == 1) {
+            work(0);
+            locals[0].rows.resize(locals[0].used);
+            return std::move(locals[0].rows);
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < workers; ++t) {
+            threads.emplace_back(work, t);
+        }
+        for (auto& thread : threads) thread.join();
+
+        // Order-preserving merge: pieces by morsel number, then one parallel copy
+        std::vector<Placed> placed;
+        for (const Local& local : locals) {
+            for (const Piece& piece : local.pieces) placed.push_back({piece, 0});
+        }
+        std::sort(placed.begin(), placed.end(),
+                  [](const Placed& a, const Placed& b) { return a.piece.morsel < b.piece.morsel; });
+        size_t total = 0;
+        for (Placed& p : placed) {
+            p.target = total;
+            total += p.piece.count;
+        }
+
+        std::vector<size_t> rows(total);
+        threads.clear();
+        for (size_t t = 0; t < workers; ++t) {
+            threads.emplace_back([&, t]() {
+                for (const Piece& piece : locals[t].pieces) {
+                    const size_t* from = locals[t].rows.data() + piece.offset;
+                    auto it = std::lower_bound(placed.begin(), placed.end(), piece.morsel,
+                                               [](const Placed& p, uint64_t morsel) { return p.piece.morsel < morsel; });
+                    std::copy(from, from + piece.count, rows.begin() + it->target);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        return rows;
+    }
+
+private:
+    struct Piece {
+        uint64_t morsel;
+        size_t offset;   // into the worker's selection vector
+        size_t count;
+    };
+
+    struct Local {
+        std::vector<size_t> rows;   // thread-local selection vector, rows[0, used) filled
+        size_t used = 0;
+        std::vector<Piece> pieces;
+    };
+
+    struct Placed {
+        Piece piece;
+        size_t target;   // offset in the merged result
+    };
+
+    size_t threads_;
+    size_t morsel_size_;
+
+    static uint64_t pack(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+    static uint64_t first(uint64_t share) { return share >> 32; }
+    static uint64_t last(uint64_t share) { return share & 0xFFFFFFFFu; }
+
+    // Takes the next morsel of worker t's share, stealing the back half of
+    // the largest other share when its own is empty
+    static bool next(std::atomic<uint64_t>* shares, size_t workers, size_t t, uint64_t& morsel) {
+        while (true) {
+            uint64_t share = shares[t].load();
+            while (first(share) < last(share)) {
+                if (shares[t].compare_exchange_weak(share, pack(first(share) + 1, last(share)))) {
+                    morsel = first(share);
+                    return true;
+                }
+            }
+
+            size_t victim = workers;
+            uint64_t victim_share = 0;
+            uint64_t most = 0;
+            for (size_t v = 0; v < workers; ++v) {
+                uint64_t other = shares[v].load();
+                if (v != t && last(other) - first(other) > most && first(other) < last(other)) {
+                    victim = v;
+                    victim_share = other;
+                    most = last(other) - first(other);
+                }
+            }
+            if (victim == workers) return false;
+
+            // Leave the victim its front half; the stolen back half becomes this worker's share
+            uint64_t split = first(victim_share) + most / 2;
+            if (shares[victim].compare_exchange_strong(victim_share, pack(first(victim_share), split))) {
+                morsel = split;
+                shares[t].store(pack(split + 1, last(victim_share)));
+                return true;
+            }
+        }
+    }
+};
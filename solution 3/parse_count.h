@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// Non-negative decimal integer spanning the whole text, for command-line
+// counts and a query's limit / offset; stoul alone accepts "-1", "3x" and " 3" and throws on the rest
+inline bool parseCount(const std::string& text, size_t& value) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    try {
+        value = std::stoul(text);
+    } catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
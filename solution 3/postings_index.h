@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "query_optimizer.h"
+#include "query_tree.h"
+#include "region_store.h"
+
+// Inverted lists of store rows per category and per group, each kept sorted
+// by (y, x) with the coordinates alongside, so a crop over one list binary
+// searches its y range and only tests x inside it. Used to start a query from
+// the points of a rare category or a few groups instead of from the space.
+// The lists are concatenated into flat columns with an offset per list, so
+// the loader can store them in the snapshot and a query views them in place
+// (see view()) instead of rebuilding them.
+class PostingsIndex {
+public:
+    // Estimate for plans without a category or group filter to start from
+    static constexpr double UNBOUNDED = std::numeric_limits<double>::infinity();
+
+    struct Columns {
+        // Category c's list is entries [category_offsets[i], category_offsets[i + 1])
+        // of the category columns, where category_keys[i] == c; keys ascend
+        Column<int> category_keys;
+        Column<uint64_t> category_offsets;
+        Column<double> category_ys;
+        Column<double> category_xs;
+        Column<uint32_t> category_rows;
+        // Lists by dense group index, laid out the same way
+        Column<uint64_t> group_offsets;
+        Column<double> group_ys;
+        Column<double> group_xs;
+        Column<uint32_t> group_rows;
+    };
+
+    PostingsIndex() = default;
+    PostingsIndex(PostingsIndex&&) = default;
+    PostingsIndex& operator=(PostingsIndex&&) = default;
+    PostingsIndex(const PostingsIndex&) = delete;
+    PostingsIndex& operator=(const PostingsIndex&) = delete;
+
+    // Index over columns owned elsewhere, which must outlive it; nothing is copied
+    static PostingsIndex view(const Columns& columns) {
+        PostingsIndex index;
+        index.columns_ = columns;
+        return index;
+    }
+
+    const Columns& columns() const { return columns_; }
+
+    explicit PostingsIndex(const RegionStore& store) {
+        size_t count = store.size();
+        if (count > UINT32_MAX) {
+            throw std::runtime_error("Too many regions for a postings index");
+        }
+        std::vector<uint32_t> order(count);
+        for (size_t i = 0; i < count; ++i) order[i] = static_cast<uint32_t>(i);
+        // Ties keep row order, so on a (y, x) sorted store every list is in row order
+        if (!store.sortedByYX()) {
+            std::sort(order.begin(), order.end(), [&store](uint32_t a, uint32_t b) {
+                if (store.ys()[a] != store.ys()[b]) return store.ys()[a] < store.ys()[b];
+                if (store.xs()[a] != store.xs()[b]) return store.xs()[a] < store.xs()[b];
+                return a < b;
+            });
+        }
+
+        category_keys_.assign(store.categories().begin(), store.categories().end());
+        std::sort(category_keys_.begin(), category_keys_.end());
+        category_keys_.erase(std::unique(category_keys_.begin(), category_keys_.end()), category_keys_.end());
+        std::vector<uint32_t> category_of(count);
+        for (size_t i = 0; i < count; ++i) {
+            category_of[i] = static_cast<uint32_t>(
+                std::lower_bound(category_keys_.begin(), category_keys_.end(), store.categories()[i]) -
+                category_keys_.begin());
+        }
+
+        // Stable distribution of the (y, x) order into the per-key lists
+        distribute(store, order, category_of, category_keys_.size(), category_offsets_, category_ys_,
+                   category_xs_, category_rows_);
+        distribute(store, order, store.groupIndices(), store.groupCount(), group_offsets_, group_ys_, group_xs_,
+                   group_rows_);
+        refreshColumns();
+    }
+
+    // Rough cost of building the index over store, in the row tests the cost
+    // choice counts: a (y, x) sort unless the store is already in that order,
+    // then two passes distributing every row
+    static double buildCost(const RegionStore& store) {
+        double count = static_cast<double>(store.size());
+        double sort = store.sortedByYX() || count < 2.0 ? 0.0 : count * std::log2(count);
+        return sort + 2.0 * count;
+    }
+
+    size_t categorySize(int category) const {
+        const Columns& c = columns_;
+        auto key = std::lower_bound(c.category_keys.begin(), c.category_keys.end(), category);
+        if (key == c.category_keys.end() || *key != category) return 0;
+        size_t list = key - c.category_keys.begin();
+        return c.category_offsets[list + 1] - c.category_offsets[list];
+    }
+
+    size_t groupSize(uint32_t group_index) const {
+        return columns_.group_offsets[group_index + 1] - columns_.group_offsets[group_index];
+    }
+
+    // Rows a postings-first evaluation of node id would test: a crop starts
+    // from its groups or its category, an AND from its cheapest operand and
+    // an OR from all of its operands
+    double estimate(const RegionStore& store, const QueryTree& tree, NodeId id) const {
+        return tree.fold<double>(id, [&](NodeId node, const std::vector<double>& operand_rows) {
+            return nodeEstimate(store, tree.node(node), operand_rows);
+        });
+    }
+
+    // Appends a superset of the rows node id selects, following the same
+    // choices as estimate(); only valid when that estimate is finite. Rows may
+    // repeat across OR operands. Each list contributes one run in (y, x) order.
+    void candidates(const RegionStore& store, const QueryTree& tree, NodeId id, std::vector<size_t>& rows) const {
+        // Every node's estimate in one pass: operands precede their operators
+        // in the arena, so theirs are known when an operator's is computed
+        std::vector<double> estimates;
+        estimates.reserve(tree.size());
+        std::vector<double> operand_rows;
+        for (NodeId node = 0; node < tree.size(); ++node) {
+            operand_rows.clear();
+            for (NodeId operand : tree.children(node)) operand_rows.push_back(estimates[operand]);
+            estimates.push_back(nodeEstimate(store, tree.node(node), operand_rows));
+        }
+
+        // Operands pushed last first, so lists are appended in operand order
+        const Columns& c = columns_;
+        std::vector<NodeId> pending = {id};
+        while (!pending.empty()) {
+            NodeId node = pending.back();
+            pending.pop_back();
+            std::visit(Overloaded{
+                [&](const CropNode& crop) {
+                    const auto& params = crop.params;
+                    if (groupRows(store, params) < categoryRows(params)) {
+                        for (long group_id : params.one_of_groups) {
+                            int64_t group = store.findGroup(group_id);
+                            if (group >= 0) {
+                                cropList(c.group_ys, c.group_xs, c.group_rows, c.group_offsets[group],
+                                         c.group_offsets[group + 1], params.region, rows);
+                            }
+                        }
+                    } else if (params.has_category) {
+                        auto key = std::lower_bound(c.category_keys.begin(), c.category_keys.end(), params.category);
+                        if (key != c.category_keys.end() && *key == params.category) {
+                            size_t list = key - c.category_keys.begin();
+                            cropList(c.category_ys, c.category_xs, c.category_rows, c.category_offsets[list],
+                                     c.category_offsets[list + 1], params.region, rows);
+                        }
+                    }
+                },
+                [&](const AndNode& and_node) {
+                    NodeId cheapest = 0;
+                    double cheapest_rows = UNBOUNDED;
+                    for (NodeId operand : tree.operands(and_node.operands)) {
+                        if (estimates[operand] < cheapest_rows) {
+                            cheapest = operand;
+                            cheapest_rows = estimates[operand];
+                        }
+                    }
+                    if (cheapest_rows < UNBOUNDED) pending.push_back(cheapest);
+                },
+                [&](const OrNode& or_node) {
+                    auto operands = tree.operands(or_node.operands);
+                    for (size_t i = operands.size(); i-- > 0;) pending.push_back(operands[i]);
+                },
+                [](const EmptyNode&) {},
+            }, tree.node(node));
+        }
+    }
+
+private:
+    Columns columns_;
+
+    // Owned storage behind columns_ for a built index
+    std::vector<int> category_keys_;
+    std::vector<uint64_t> category_offsets_;
+    std::vector<double> category_ys_;
+    std::vector<double> category_xs_;
+    std::vector<uint32_t> category_rows_;
+    std::vector<uint64_t> group_offsets_;
+    std::vector<double> group_ys_;
+    std::vector<double> group_xs_;
+    std::vector<uint32_t> group_rows_;
+
+    void refreshColumns() {
+        columns_.category_keys = {category_keys_.data(), category_keys_.size()};
+        columns_.category_offsets = {category_offsets_.data(), category_offsets_.size()};
+        columns_.category_ys = {category_ys_.data(), category_ys_.size()};
+        columns_.category_xs = {category_xs_.data(), category_xs_.size()};
+        columns_.category_rows = {category_rows_.data(), category_rows_.size()};
+        columns_.group_offsets = {group_offsets_.data(), group_offsets_.size()};
+        columns_.group_ys = {group_ys_.data(), group_ys_.size()};
+        columns_.group_xs = {group_xs_.data(), group_xs_.size()};
+        columns_.group_rows = {group_rows_.data(), group_rows_.size()};
+    }
+
+    // Counting sort of the rows in order by list[row], into lists entries
+    // delimited by offsets
+    template <typename Lists>
+    static void distribute(const RegionStore& store, const std::vector<uint32_t>& order, const Lists& list,
+                           size_t lists, std::vector<uint64_t>& offsets, std::vector<double>& ys,
+                           std::vector<double>& xs, std::vector<uint32_t>& rows) {
+        offsets.assign(lists + 1, 0);
+        for (uint32_t row : order) ++offsets[list[row] + 1];
+        for (size_t i = 0; i < lists; ++i) offsets[i + 1] += offsets[i];
+        std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+        ys.resize(order.size());
+        xs.resize(order.size());
+        rows.resize(order.size());
+        for (uint32_t row : order) {
+            uint64_t slot = next[list[row]]++;
+            ys[slot] = store.ys()[row];
+            xs[slot] = store.xs()[row];
+            rows[slot] = row;
+        }
+    }
+
+    // Estimate of a node from those of its operands, in operand order
+    double nodeEstimate(const RegionStore& store, const QueryNode& node, const std::vector<double>& operand_rows) const {
+        return std::visit(Overloaded{
+            [&](const CropNode& crop) {
+                const auto& params = crop.params;
+                return std::min(groupRows(store, params), categoryRows(params));
+            },
+            [&](const AndNode&) {
+                double rows = UNBOUNDED;
+                for (double operand : operand_rows) rows = std::min(rows, operand);
+                return rows;
+            },
+            [&](const OrNode&) {
+                double rows = 0.0;
+                for (double operand : operand_rows) rows += operand;
+                return rows;
+            },
+            [](const EmptyNode&) { return 0.0; },
+        }, node);
+    }
+
+    double groupRows(const RegionStore& store, const CropParams& params) const {
+        if (!QueryOptimizer::hasGroupFilter(params)) return UNBOUNDED;
+        double rows = 0.0;
+        for (long group_id : params.one_of_groups) {
+            int64_t group = store.findGroup(group_id);
+            if (group >= 0) rows += groupSize(static_cast<uint32_t>(group));
+        }
+        return rows;
+    }
+
+    double categoryRows(const CropParams& params) const {
+        return params.has_category ? static_cast<double>(categorySize(params.category)) : UNBOUNDED;
+    }
+
+    // Rows of list entries [begin, end) inside region
+    static void cropList(const Column<double>& ys, const Column<double>& xs, const Column<uint32_t>& list_rows,
+                         size_t begin, size_t end, const Region& region, std::vector<size_t>& rows) {
+        const double* first = std::lower_bound(ys.begin() + begin, ys.begin() + end, region.p_min_y);
+        const double* last = std::upper_bound(first, ys.begin() + end, region.p_max_y);
+        for (size_t i = first - ys.begin(), stop = last - ys.begin(); i < stop; ++i) {
+            if (xs[i] >= region.p_min_x && xs[i] <= region.p_max_x) {
+                rows.push_back(list_rows[i]);
+            }
+        }
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "crop_kernel.h"
+#include "region_store.h"
+
+// Compact copy of the coordinate columns, 4 bytes per value instead of 8,
+// stored either as float32 or as 32-bit fixed point over the store's extent.
+// Both encodings are monotone (v <= w implies q(v) <= q(w)), so encoding the
+// crop bounds the same way gives a conservative test: every point inside the
+// crop passes q(min) <= q(v) <= q(max), and a point strictly between the
+// encoded bounds is certainly inside. Only the points equal to an encoded
+// bound on some axis are rechecked against the exact doubles, which keeps the
+// selection identical to CropKernel over the double columns.
+class QuantizedColumns {
+public:
+    enum class Encoding { Float32, Fixed32 };
+
+    QuantizedColumns(const RegionStore& store, Encoding encoding) : store_(store), encoding_(encoding) {
+        size_t count = store.size();
+        if (encoding_ == Encoding::Float32) {
+            fx_.resize(count);
+            fy_.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                fx_[i] = static_cast<float>(store.xs()[i]);
+                fy_[i] = static_cast<float>(store.ys()[i]);
+            }
+            return;
+        }
+
+        if (count > 0) {
+            origin_x_ = *std::min_element(store.xs().begin(), store.xs().end());
+            origin_y_ = *std::min_element(store.ys().begin(), store.ys().end());
+            double width = *std::max_element(store.xs().begin(), store.xs().end()) - origin_x_;
+            double height = *std::max_element(store.ys().begin(), store.ys().end()) - origin_y_;
+            scale_x_ = width > 0.0 ? FIXED_STEPS / width : 0.0;
+            scale_y_ = height > 0.0 ? FIXED_STEPS / height : 0.0;
+        }
+        ix_.resize(count);
+        iy_.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            ix_[i] = fixed(store.xs()[i], origin_x_, scale_x_);
+            iy_[i] = fixed(store.ys()[i], origin_y_, scale_y_);
+        }
+    }
+
+    Encoding encoding() const { return encoding_; }
+    const char* name() const { return encoding_ == Encoding::Float32 ? "float32" : "fixed32"; }
+
+    // Rows inside filter in row order, exactly as CropKernel::select would
+    // return them; out must have room for size() entries
+    size_t select(const CropKernel::Filter& filter, size_t* out, bool simd = true) const {
+        const int* categories = store_.categories().data();
+        size_t count = store_.size();
+        size_t candidates;
+
+        if (encoding_ == Encoding::Float32) {
+            Bounds<float> bounds = {static_cast<float>(filter.region.p_min_x), static_cast<float>(filter.region.p_max_x),
+                                    static_cast<float>(filter.region.p_min_y), static_cast<float>(filter.region.p_max_y)};
+#if CROP_KERNEL_X86
+            if (simd && hasAvx2()) {
+                candidates = selectFloatAvx2(fx_.data(), fy_.data(), categories, count, bounds, filter, out);
+            } else
+#endif
+            candidates = selectScalar(fx_.data(), fy_.data(), categories, 0, count, bounds, filter, out, 0);
+            return recheck(fx_.data(), fy_.data(), bounds, filter, out, candidates);
+        }
+
+        Bounds<int32_t> bounds = {fixed(filter.region.p_min_x, origin_x_, scale_x_), fixed(filter.region.p_max_x, origin_x_, scale_x_),
+                                  fixed(filter.region.p_min_y, origin_y_, scale_y_), fixed(filter.region.p_max_y, origin_y_, scale_y_)};
+#if CROP_KERNEL_X86
+        if (simd && hasAvx2()) {
+            candidates = selectFixedAvx2(ix_.data(), iy_.data(), categories, count, bounds, filter, out);
+        } else
+#endif
+        candidates = selectScalar(ix_.data(), iy_.data(), categories, 0, count, bounds, filter, out, 0);
+        return recheck(ix_.data(), iy_.data(), bounds, filter, out, candidates);
+    }
+
+private:
+    // 2^32 - 1 steps across the extent
+    static constexpr double FIXED_STEPS = 4294967295.0;
+
+    template <typename T>
+    struct Bounds {
+        T min_x, max_x, min_y, max_y;
+    };
+
+    const RegionStore& store_;
+    Encoding encoding_;
+    std::vector<float> fx_;
+    std::vector<float> fy_;
+    std::vector<int32_t> ix_;
+    std::vector<int32_t> iy_;
+    double origin_x_ = 0.0;
+    double origin_y_ = 0.0;
+    double scale_x_ = 0.0;
+    double scale_y_ = 0.0;
+
+    // Steps from the origin, clamped to the 32-bit range and biased so signed
+    // comparison orders them like the unsigned step count
+    static int32_t fixed(double value, double origin, double scale) {
+        double steps = std::floor((value - origin) * scale);
+        steps = std::min(FIXED_STEPS, std::max(0.0, steps));
+        return static_cast<int32_t>(static_cast<int64_t>(steps) - 2147483648LL);
+    }
+
+    static bool hasAvx2() {
+#if CROP_KERNEL_X86
+        static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    // Candidates whose encoded coordinates lie within the encoded bounds
+    template <typename T>
+    static size_t selectScalar(const T* xs, const T* ys, const int* categories, size_t begin, size_t count,
+                               const Bounds<T>& bounds, const CropKernel::Filter& filter, size_t* out, size_t selected) {
+        for (size_t i = begin; i < count; ++i) {
+            bool inside = xs[i] >= bounds.min_x && xs[i] <= bounds.max_x &&
+                          ys[i] >= bounds.min_y && ys[i] <= bounds.max_y &&
+                          (!filter.has_category || categories[i] == filter.category);
+            out[selected] = i;
+            selected += inside;
+        }
+        return selected;
+    }
+
+    // Keeps candidates strictly inside the encoded bounds and tests the rest on the doubles
+    template <typename T>
+    size_t recheck(const T* xs, const T* ys, const Bounds<T>& bounds, const CropKernel::Filter& filter,
+                   size_t* out, size_t candidates) const {
+        const Region& region = filter.region;
+        size_t kept = 0;
+        for (size_t c = 0; c < candidates; ++c) {
+            size_t i = out[c];
+            bool certain = xs[i] > bounds.min_x && xs[i] < bounds.max_x && ys[i] > bounds.min_y && ys[i] < bounds.max_y;
+            if (certain || (store_.xs()[i] >= region.p_min_x && store_.xs()[i] <= region.p_max_x &&
+                            store_.ys()[i] >= region.p_min_y && store_.ys()[i] <= region.p_max_y)) {
+                out[kept++] = i;
+            }
+        }
+        return kept;
+    }
+
+#if CROP_KERNEL_X86
+    // Writes every lane's position and advances only past the selected ones
+    __attribute__((target("avx2")))
+    static size_t compact8(unsigned mask, size_t i, size_t* out, size_t selected) {
+        for (int lane = 0; lane < 8; ++lane) {
+            out[selected] = i + lane;
+            selected += (mask >> lane) & 1;
+        }
+        return selected;
+    }
+
+    __attribute__((target("avx2")))
+    static unsigned categoryMask8(const int* categories, size_t i, const CropKernel::Filter& filter) {
+        __m256i same = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(categories + i)),
+                                          _mm256_set1_epi32(filter.category));
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(same)));
+    }
+
+    __attribute__((target("avx2")))
+    static size_t selectFloatAvx2(const float* xs, const float* ys, const int* categories, size_t count,
+                                  const Bounds<float>& bounds, const CropKernel::Filter& filter, size_t* out) {
+        const __m256 min_x = _mm256_set1_ps(bounds.min_x);
+        const __m256 max_x = _mm256_set1_ps(bounds.max_x);
+        const __m256 min_y = _mm256_set1_ps(bounds.min_y);
+        const __m256 max_y = _mm256_set1_ps(bounds.max_y);
+
+        size_t selected = 0;
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 x = _mm256_loadu_ps(xs + i);
+            __m256 y = _mm256_loadu_ps(ys + i);
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, min_x, _CMP_GE_OQ), _mm256_cmp_ps(x, max_x, _CMP_LE_OQ)),
+                                          _mm256_and_ps(_mm256_cmp_ps(y, min_y, _CMP_GE_OQ), _mm256_cmp_ps(y, max_y, _CMP_LE_OQ)));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(inside));
+            if (filter.has_category) mask &= categoryMask8(categories, i, filter);
+            selected = compact8(mask, i, out, selected);
+        }
+        return selectScalar(xs, ys, categories, i, count, bounds, filter, out, selected);
+    }
+
+    __attribute__((target("avx2")))
+    static size_t selectFixedAvx2(const int32_t* xs, const int32_t* ys, const int* categories, size_t count,
+                                  const Bounds<int32_t>& bounds, const CropKernel::Filter& filter, size_t* out) {
+        const __m256i min_x = _mm256_set1_epi32(bounds.min_x);
+        const __m256i max_x = _mm256_set1_epi32(bounds.max_x);
+        const __m256i min_y = _mm256_set1_epi32(bounds.min_y);
+        const __m256i max_y = _mm256_set1_epi32(bounds.max_y);
+
+        size_t selected = 0;
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i));
+            // Outside when below the minimum or above the maximum on either axis
+            __m256i outside = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(min_x, x), _mm256_cmpgt_epi32(x, max_x)),
+                                              _mm256_or_si256(_mm256_cmpgt_epi32(min_y, y), _mm256_cmpgt_epi32(y, max_y)));
+            unsigned mask = ~static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(outside))) & 0xFF;
+            if (filter.has_category) mask &= categoryMask8(categories, i, filter);
+            selected = compact8(mask, i, out, selected);
+        }
+        return selectScalar(xs, ys, categories, i, count, bounds, filter, out, selected);
+    }
+#endif
+};
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "query_tree.h"
+
+// Rule-based rewrites applied to the parsed operator tree before execution.
+// The input tree is left untouched; the rewritten plan is built in a new arena.
+class QueryOptimizer {
+public:
+    static QueryTree optimize(const QueryTree& tree) {
+        QueryTree optimized;
+        optimized.reserve(tree.size());
+        optimized.setRoot(rewrite(tree, tree.root(), optimized));
+        optimized.setPage(tree.page());
+        optimized.setAggregate(tree.aggregate());
+        return optimized;
+    }
+
+    // Rough size of an operand's result, only meaningful relative to other operands.
+    // Crops are weighted by region area and scaled down for every extra filter.
+    static double estimateCost(const QueryTree& tree, NodeId id) {
+        return tree.fold<double>(id, [&tree](NodeId node, const std::vector<double>& operand_costs) {
+            return nodeCost(tree.node(node), operand_costs);
+        });
+    }
+
+    // Indented, one node per line rendering of the plan
+    static std::string describe(const QueryTree& tree) {
+        // Every estimate in one bottom-up pass instead of one walk per line
+        std::vector<double> costs;
+        extendCosts(tree, costs);
+
+        // Pre-order, operands pushed last first so they print in order. Lines
+        // deeper than MAX_INDENT levels stop indenting and name their depth,
+        // so a deep chain does not print a quadratic amount of padding.
+        std::ostringstream out;
+        std::vector<std::pair<NodeId, size_t>> pending = {{tree.root(), 0}};   // (node, depth)
+        while (!pending.empty()) {
+            auto [id, depth] = pending.back();
+            pending.pop_back();
+            out << std::string(std::min(depth, MAX_INDENT) * 2, ' ');
+            if (depth > MAX_INDENT) out << "[depth " << depth << "] ";
+            out << label(tree, id);
+            if (!isEmpty(tree, id)) out << " est=" << costs[id];
+            out << "\n";
+            auto operands = tree.children(id);
+            for (size_t i = operands.size(); i-- > 0;) pending.push_back({operands[i], depth + 1});
+        }
+        return out.str();
+    }
+
+    // One-line description of a single node, without its operands
+    static std::string label(const QueryTree& tree, NodeId id) {
+        std::ostringstream out;
+        std::visit(Overloaded{
+            [&](const CropNode& crop) {
+                const auto& params = crop.params;
+                out << "CROP region=(" << params.region.p_min_x << "," << params.region.p_min_y
+                    << ")-(" << params.region.p_max_x << "," << params.region.p_max_y << ")";
+                if (params.has_category) out << " category=" << params.category;
+                if (hasGroupFilter(params)) out << " groups_count=" << params.one_of_groups.size();
+                if (params.proper) out << " proper";
+            },
+            [&](const AndNode& node) { out << "AND operands=" << node.operands.count; },
+            [&](const OrNode& node) { out << "OR operands=" << node.operands.count; },
+            [&](const EmptyNode&) { out << "EMPTY"; },
+        }, tree.node(id));
+        return out.str();
+    }
+
+    // Smallest rectangle holding every point the node can select. Returns false
+    // when the node selects nothing.
+    static bool boundingRegion(const QueryTree& tree, NodeId id, Region& bounds) {
+        using Bounds = std::optional<Region>;   // none when nothing is selected
+        Bounds result = tree.fold<Bounds>(id, [&tree](NodeId node, const std::vector<Bounds>& operands) {
+            return std::visit(Overloaded{
+                [](const CropNode& crop) {
+                    return isEmptyRegion(crop.params.region) ? Bounds() : Bounds(crop.params.region);
+                },
+                [&](const AndNode&) {
+                    if (operands.empty()) return Bounds();
+                    Region region = {};
+                    for (size_t i = 0; i < operands.size(); ++i) {
+                        if (!operands[i]) return Bounds();
+                        const Region& operand = *operands[i];
+                        region = i == 0 ? operand : Region{std::max(region.p_min_x, operand.p_min_x),
+                                                           std::max(region.p_min_y, operand.p_min_y),
+                                                           std::min(region.p_max_x, operand.p_max_x),
+                                                           std::min(region.p_max_y, operand.p_max_y)};
+                    }
+                    return isEmptyRegion(region) ? Bounds() : Bounds(region);
+                },
+                [&](const OrNode&) {
+                    Bounds region;
+                    for (const Bounds& operand : operands) {
+                        if (!operand) continue;
+                        region = !region ? *operand : Region{std::min(region->p_min_x, operand->p_min_x),
+                                                             std::min(region->p_min_y, operand->p_min_y),
+                                                             std::max(region->p_max_x, operand->p_max_x),
+                                                             std::max(region->p_max_y, operand->p_max_y)};
+                    }
+                    return region;
+                },
+                [](const EmptyNode&) { return Bounds(); },
+            }, tree.node(node));
+        });
+        if (!result) return false;
+        bounds = *result;
+        return true;
+    }
+
+    // An empty one_of_groups list does not filter anything (see buildCropQuery)
+    static bool hasGroupFilter(const CropParams& params) {
+        return params.has_one_of_groups && !params.one_of_groups.empty();
+    }
+
+private:
+    static constexpr double CATEGORY_SELECTIVITY = 0.25;
+    static constexpr double GROUP_SELECTIVITY = 0.1;
+    static constexpr double PROPER_SELECTIVITY = 0.5;
+    static constexpr size_t MAX_INDENT = 32;   // levels describe() indents
+
+    static bool isEmptyRegion(const Region& region) {
+        return region.p_min_x > region.p_max_x || region.p_min_y > region.p_max_y;
+    }
+
+    static bool regionsOverlap(const Region& a, const Region& b) {
+        return a.p_min_x <= b.p_max_x && b.p_min_x <= a.p_max_x &&
+               a.p_min_y <= b.p_max_y && b.p_min_y <= a.p_max_y;
+    }
+
+    static bool regionContains(const Region& outer, const Region& inner) {
+        return outer.p_min_x <= inner.p_min_x && inner.p_max_x <= outer.p_max_x &&
+               outer.p_min_y <= inner.p_min_y && inner.p_max_y <= outer.p_max_y;
+    }
+
+    // Everything but the region: proper, the category if any and the sorted,
+    // distinct group list if any. Crops with equal keys filter the same way.
+    using FilterKey = std::tuple<bool, bool, int, bool, std::vector<long>>;
+
+    static FilterKey filterKey(const CropParams& params) {
+        std::vector<long> groups;
+        if (hasGroupFilter(params)) {
+            groups = params.one_of_groups;
+            std::sort(groups.begin(), groups.end());
+            groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+        }
+        return FilterKey(params.proper, params.has_category, params.has_category ? params.category : 0,
+                         hasGroupFilter(params), std::move(groups));
+    }
+
+    static bool isEmpty(const QueryTree& tree, NodeId id) {
+        return std::holds_alternative<EmptyNode>(tree.node(id));
+    }
+
+    static const CropParams* cropParams(const QueryTree& tree, NodeId id) {
+        const auto* crop = std::get_if<CropNode>(&tree.node(id));
+        return crop ? &crop->params : nullptr;
+    }
+
+    // Estimate of a node from those of its operands, in operand order
+    static double nodeCost(const QueryNode& node, const std::vector<double>& operand_costs) {
+        return std::visit(Overloaded{
+            [](const CropNode& crop) {
+                const auto& params = crop.params;
+                double cost = std::max(0.0, params.region.p_max_x - params.region.p_min_x) *
+                              std::max(0.0, params.region.p_max_y - params.region.p_min_y);
+                if (params.has_category) cost *= CATEGORY_SELECTIVITY;
+                if (hasGroupFilter(params)) cost *= GROUP_SELECTIVITY;
+                if (params.proper) cost *= PROPER_SELECTIVITY;
+                return cost;
+            },
+            [&](const AndNode&) {
+                return operand_costs.empty() ? 0.0 : *std::min_element(operand_costs.begin(), operand_costs.end());
+            },
+            [&](const OrNode&) {
+                double cost = 0.0;
+                for (double operand_cost : operand_costs) cost += operand_cost;
+                return cost;
+            },
+            [](const EmptyNode&) { return 0.0; },
+        }, node);
+    }
+
+    // Appends to costs, indexed by node id, the estimate of every node added
+    // to tree since costs was last extended. Operands are added before their
+    // parents, so their estimates are already there.
+    static void extendCosts(const QueryTree& tree, std::vector<double>& costs) {
+        std::vector<double> operand_costs;
+        for (NodeId id = static_cast<NodeId>(costs.size()); id < tree.size(); ++id) {
+            operand_costs.clear();
+            for (NodeId operand : tree.children(id)) operand_costs.push_back(costs[operand]);
+            costs.push_back(nodeCost(tree.node(id), operand_costs));
+        }
+    }
+
+    // Rewrites the subtree under id into out, operands before their operator,
+    // and returns the id of the result in out
+    static NodeId rewrite(const QueryTree& tree, NodeId id, QueryTree& out) {
+        std::vector<double> costs;   // estimates of out's nodes, see extendCosts
+        return tree.fold<NodeId>(id, [&](NodeId node, const std::vector<NodeId>& operands) {
+            return std::visit([&](const auto& typed) { return rewriteNode(typed, operands, out, costs); },
+                              tree.node(node));
+        });
+    }
+
+    static NodeId rewriteNode(const CropNode& crop, const std::vector<NodeId>&, QueryTree& out, std::vector<double>&) {
+        if (isEmptyRegion(crop.params.region)) {
+            return out.addEmpty();
+        }
+        return out.addCrop(crop.params);
+    }
+
+    static NodeId rewriteNode(const EmptyNode&, const std::vector<NodeId>&, QueryTree& out, std::vector<double>&) {
+        return out.addEmpty();
+    }
+
+    // Intersection of two crops as a single crop. Returns false when the
+    // intersection is provably empty. Only valid when both crops agree on
+    // "proper": a proper group inside both regions is inside their intersection,
+    // but a proper crop cannot absorb a plain one.
+    static bool intersectCrops(const CropParams& a, const CropParams& b, CropParams& merged) {
+        merged = a;
+        merged.region.p_min_x = std::max(a.region.p_min_x, b.region.p_min_x);
+        merged.region.p_min_y = std::max(a.region.p_min_y, b.region.p_min_y);
+        merged.region.p_max_x = std::min(a.region.p_max_x, b.region.p_max_x);
+        merged.region.p_max_y = std::min(a.region.p_max_y, b.region.p_max_y);
+        if (isEmptyRegion(merged.region)) return false;
+
+        if (b.has_category) {
+            if (a.has_category && a.category != b.category) return false;
+            merged.has_category = true;
+            merged.category = b.category;
+        }
+
+        if (hasGroupFilter(a) && hasGroupFilter(b)) {
+            std::set<long> b_groups(b.one_of_groups.begin(), b.one_of_groups.end());
+            merged.one_of_groups.clear();
+            for (long group : std::set<long>(a.one_of_groups.begin(), a.one_of_groups.end())) {
+                if (b_groups.count(group)) merged.one_of_groups.push_back(group);
+            }
+            if (merged.one_of_groups.empty()) return false;
+        } else if (hasGroupFilter(b)) {
+            merged.has_one_of_groups = true;
+            merged.one_of_groups = b.one_of_groups;
+        }
+
+        return true;
+    }
+
+    // Union of two crops with identical filters (equal filterKey) as a single
+    // crop, when the union of their regions is itself a rectangle. Proper crops
+    // only merge by containment, since a group spanning both regions is proper
+    // for neither.
+    static bool unionCrops(const CropParams& a, const CropParams& b, CropParams& merged) {
+        if (regionContains(a.region, b.region)) {
+            merged = a;
+            return true;
+        }
+        if (regionContains(b.region, a.region)) {
+            merged = b;
+            return true;
+        }
+        if (a.proper || !regionsOverlap(a.region, b.region)) return false;
+
+        bool same_x = a.region.p_min_x == b.region.p_min_x && a.region.p_max_x == b.region.p_max_x;
+        bool same_y = a.region.p_min_y == b.region.p_min_y && a.region.p_max_y == b.region.p_max_y;
+        if (!same_x && !same_y) return false;
+
+        merged = a;
+        merged.region.p_min_x = std::min(a.region.p_min_x, b.region.p_min_x);
+        merged.region.p_min_y = std::min(a.region.p_min_y, b.region.p_min_y);
+        merged.region.p_max_x = std::max(a.region.p_max_x, b.region.p_max_x);
+        merged.region.p_max_y = std::max(a.region.p_max_y, b.region.p_max_y);
+        return true;
+    }
+
+    // rewritten holds the operands already rewritten into out
+    static NodeId rewriteNode(const AndNode&, const std::vector<NodeId>& rewritten, QueryTree& out,
+                              std::vector<double>& costs) {
+        // Flatten nested ANDs
+        std::vector<NodeId> operands;
+        for (NodeId optimized : rewritten) {
+            if (isEmpty(out, optimized)) {
+                return out.addEmpty();
+            }
+            if (const auto* nested_and = std::get_if<AndNode>(&out.node(optimized))) {
+                auto nested = out.operands(nested_and->operands);
+                operands.insert(operands.end(), nested.begin(), nested.end());
+            } else {
+                operands.push_back(optimized);
+            }
+        }
+        if (operands.empty()) {
+            return out.addEmpty();
+        }
+
+        // Fold all plain crops into one crop and all proper crops into another
+        bool has_plain = false, has_proper = false;
+        CropParams plain_crop, proper_crop;
+        std::vector<NodeId> others;
+        for (NodeId operand : operands) {
+            const CropParams* params = cropParams(out, operand);
+            if (!params) {
+                others.push_back(operand);
+                continue;
+            }
+            bool& seen = params->proper ? has_proper : has_plain;
+            CropParams& slot = params->proper ? proper_crop : plain_crop;
+            if (!seen) {
+                seen = true;
+                slot = *params;
+                continue;
+            }
+            CropParams merged;
+            if (!intersectCrops(slot, *params, merged)) {
+                return out.addEmpty();
+            }
+            slot = merged;
+        }
+
+        // Every result point lies in both regions, so disjoint crops select nothing
+        if (has_plain && has_proper && !regionsOverlap(plain_crop.region, proper_crop.region)) {
+            return out.addEmpty();
+        }
+
+        std::vector<NodeId> result;
+        if (has_plain) result.push_back(out.addCrop(plain_crop));
+        if (has_proper) result.push_back(out.addCrop(proper_crop));
+        result.insert(result.end(), others.begin(), others.end());
+        if (result.size() == 1) {
+            return result[0];
+        }
+
+        // Most selective operand first so the running intersection stays small.
+        // costs follows out as it grows, so no operand's subtree is walked again.
+        extendCosts(out, costs);
+        std::vector<std::pair<double, NodeId>> by_cost;
+        for (NodeId operand : result) {
+            by_cost.emplace_back(costs[operand], operand);
+        }
+        std::stable_sort(by_cost.begin(), by_cost.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i] = by_cost[i].second;
+        }
+
+        return out.addAnd(result);
+    }
+
+    static NodeId rewriteNode(const OrNode&, const std::vector<NodeId>& rewritten, QueryTree& out,
+                              std::vector<double>&) {
+        // Drop empty operands and flatten nested ORs
+        std::vector<NodeId> operands;
+        for (NodeId optimized : rewritten) {
+            if (isEmpty(out, optimized)) {
+                continue;
+            }
+            if (const auto* nested_or = std::get_if<OrNode>(&out.node(optimized))) {
+                auto nested = out.operands(nested_or->operands);
+                operands.insert(operands.end(), nested.begin(), nested.end());
+            } else {
+                operands.push_back(optimized);
+            }
+        }
+
+        // Only crops with the same filters merge, so crops are bucketed by
+        // filter key and a single sweep merges each one into the surviving
+        // crops of its bucket. A merge grows the crop, which may then absorb
+        // survivors it missed, so its bucket is rescanned until nothing merges;
+        // the result takes the earlier slot and the absorbed one is dropped.
+        std::map<FilterKey, std::vector<size_t>> survivors;   // slots in operands
+        std::vector<CropParams> crops(operands.size());
+        std::vector<bool> absorbed(operands.size(), false);
+        for (size_t i = 0; i < operands.size(); ++i) {
+            const CropParams* crop = cropParams(out, operands[i]);
+            if (!crop) continue;
+            auto& bucket = survivors[filterKey(*crop)];
+            size_t slot = i;
+            crops[slot] = *crop;
+            bool grown = false;
+            for (size_t s = 0; s < bucket.size();) {
+                CropParams merged;
+                if (!unionCrops(crops[bucket[s]], crops[slot], merged)) {
+                    ++s;
+                    continue;
+                }
+                size_t kept = std::min(bucket[s], slot);
+                absorbed[std::max(bucket[s], slot)] = true;
+                crops[kept] = merged;
+                slot = kept;
+                grown = true;
+                bucket.erase(bucket.begin() + s);
+                s = 0;
+            }
+            bucket.push_back(slot);
+            if (grown) {
+                operands[slot] = out.addCrop(crops[slot]);
+            }
+        }
+        size_t kept_count = 0;
+        for (size_t i = 0; i < operands.size(); ++i) {
+            if (!absorbed[i]) operands[kept_count++] = operands[i];
+        }
+        operands.resize(kept_count);
+
+        if (operands.empty()) {
+            return out.addEmpty();
+        }
+        if (operands.size() == 1) {
+            return operands[0];
+        }
+        return out.addOr(operands);
+    }
+
+};
+
+// Hash-conses an operator tree: structurally identical subtrees are replaced
+// by one shared node, turning the tree into a DAG. AND/OR operands are
+// compared as sets, so reordered duplicates are shared as well.
+class QueryInterner {
+public:
+    QueryTree intern(const QueryTree& tree) {
+        QueryTree shared;
+        shared.reserve(tree.size());
+        nodes_by_key_.clear();
+        tree_nodes_ = 0;
+        shared.setRoot(internNode(tree, tree.root(), shared));
+        shared.setPage(tree.page());
+        shared.setAggregate(tree.aggregate());
+
+        references_.assign(shared.size(), 0);
+        countReferences(shared, shared.root());
+        dag_nodes_ = shared.size();
+        return shared;
+    }
+
+    // Number of tree nodes that disappeared because they duplicated another subtree
+    size_t duplicateCount() const { return tree_nodes_ - dag_nodes_; }
+
+    // Indexed by node id of the interned tree: nodes reachable from more than
+    // one parent, the only ones worth caching
+    std::vector<bool> sharedNodes() const {
+        std::vector<bool> shared(references_.size());
+        for (size_t id = 0; id < references_.size(); ++id) {
+            shared[id] = references_[id] > 1;
+        }
+        return shared;
+    }
+
+private:
+    std::unordered_map<std::string, NodeId> nodes_by_key_;
+    std::vector<uint32_t> references_;
+    size_t tree_nodes_ = 0;
+    size_t dag_nodes_ = 0;
+
+    // Interns the subtree under id, operands before their operator
+    NodeId internNode(const QueryTree& tree, NodeId id, QueryTree& shared) {
+        return tree.fold<NodeId>(id, [&](NodeId node_id, const std::vector<NodeId>& operands) {
+            ++tree_nodes_;
+            const QueryNode& node = tree.node(node_id);
+
+            std::string key;
+            if (const auto* crop = std::get_if<CropNode>(&node)) {
+                key = cropKey(crop->params);
+            } else if (std::holds_alternative<AndNode>(node)) {
+                key = "AND" + operandsKey(operands);
+            } else if (std::holds_alternative<OrNode>(node)) {
+                key = "OR" + operandsKey(operands);
+            } else {
+                key = "EMPTY";
+            }
+
+            auto it = nodes_by_key_.find(key);
+            if (it != nodes_by_key_.end()) {
+                return it->second;
+            }
+
+            NodeId interned = std::visit(Overloaded{
+                [&](const CropNode& crop) { return shared.addCrop(crop.params); },
+                [&](const AndNode&) { return shared.addAnd(operands); },
+                [&](const OrNode&) { return shared.addOr(operands); },
+                [&](const EmptyNode&) { return shared.addEmpty(); },
+            }, node);
+            nodes_by_key_.emplace(key, interned);
+            return interned;
+        });
+    }
+
+    // Counts parents per node, descending into each shared node only once
+    void countReferences(const QueryTree& tree, NodeId root) {
+        std::vector<NodeId> pending = {root};
+        while (!pending.empty()) {
+            NodeId id = pending.back();
+            pending.pop_back();
+            for (NodeId operand : tree.children(id)) {
+                if (++references_[operand] == 1) {
+                    pending.push_back(operand);
+                }
+            }
+        }
+    }
+
+    static std::string operandsKey(std::vector<NodeId> ids) {
+        std::sort(ids.begin(), ids.end());
+
+        std::string key = "(";
+        for (NodeId id : ids) {
+            key += std::to_string(id) + ",";
+        }
+        return key + ")";
+    }
+
+    // Exact (hexfloat) rendering so only bit-identical regions compare equal
+    static std::string cropKey(const CropParams& params) {
+        std::ostringstream key;
+        key << std::hexfloat << "CROP(" << params.region.p_min_x << "," << params.region.p_min_y << ","
+            << params.region.p_max_x << "," << params.region.p_max_y << ")";
+        if (params.has_category) key << "c" << params.category;
+        if (QueryOptimizer::hasGroupFilter(params)) {
+            key << "g";
+            for (long group : std::set<long>(params.one_of_groups.begin(), params.one_of_groups.end())) {
+                key << group << ",";
+            }
+        }
+        if (params.proper) key << "p";
+        return key.str();
+    }
+};
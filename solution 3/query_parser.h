@@ -0,0 +1,489 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "parse_count.h"
+#include "query_tree.h"
+
+// Streaming (SAX style) JSON reader. Walks the document once, left to right,
+// and reports structure to a handler:
+//   startObject() endObject() startArray() endArray()
+//   key(const std::string&) string(const std::string&)
+//   number(const char* text, size_t length) boolean(bool) null()
+// Nesting is tracked on an explicit stack, so depth is only bounded by memory.
+class JsonSaxReader {
+public:
+    template <typename Handler>
+    static void parse(const std::string& content, Handler& handler) {
+        JsonSaxReader reader(content);
+        reader.run(handler);
+    }
+
+private:
+    enum class Expect { Value, ValueOrEnd, KeyOrEnd, Key, Colon, CommaOrEnd, Done };
+
+    const std::string& content_;
+    size_t pos_;
+    std::vector<char> containers_;
+    std::string buffer_;
+
+    explicit JsonSaxReader(const std::string& content) : content_(content), pos_(0) {}
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("JSON parse error at offset " + std::to_string(pos_) + ": " + message);
+    }
+
+    void skipWhitespace() {
+        while (pos_ < content_.size()) {
+            char c = content_[pos_];
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t') break;
+            ++pos_;
+        }
+    }
+
+    template <typename Handler>
+    void run(Handler& handler) {
+        Expect expect = Expect::Value;
+
+        while (true) {
+            skipWhitespace();
+            if (pos_ >= content_.size()) {
+                if (expect != Expect::Done) fail("unexpected end of input");
+                return;
+            }
+            char c = content_[pos_];
+
+            switch (expect) {
+            case Expect::Done:
+                fail("unexpected data after the document");
+
+            case Expect::KeyOrEnd:
+                if (c == '}') {
+                    ++pos_;
+                    expect = closeContainer(handler);
+                    break;
+                }
+                // fall through
+            case Expect::Key:
+                if (c != '"') fail("expected object key");
+                readString();
+                handler.key(buffer_);
+                expect = Expect::Colon;
+                break;
+
+            case Expect::Colon:
+                if (c != ':') fail("expected ':'");
+                ++pos_;
+                expect = Expect::Value;
+                break;
+
+            case Expect::CommaOrEnd:
+                if (c == ',') {
+                    ++pos_;
+                    expect = containers_.back() == '}' ? Expect::Key : Expect::Value;
+                } else if (c == containers_.back()) {
+                    ++pos_;
+                    expect = closeContainer(handler);
+                } else {
+                    fail("expected ',' or end of container");
+                }
+                break;
+
+            case Expect::ValueOrEnd:
+                if (c == ']') {
+                    ++pos_;
+                    expect = closeContainer(handler);
+                    break;
+                }
+                // fall through
+            case Expect::Value:
+                expect = readValue(c, handler);
+                break;
+            }
+        }
+    }
+
+    // State after a complete value at the current depth
+    Expect afterValue() const {
+        return containers_.empty() ? Expect::Done : Expect::CommaOrEnd;
+    }
+
+    template <typename Handler>
+    Expect closeContainer(Handler& handler) {
+        char closing = containers_.back();
+        containers_.pop_back();
+        if (closing == '}') {
+            handler.endObject();
+        } else {
+            handler.endArray();
+        }
+        return afterValue();
+    }
+
+    template <typename Handler>
+    Expect readValue(char c, Handler& handler) {
+        switch (c) {
+        case '{':
+            ++pos_;
+            containers_.push_back('}');
+            handler.startObject();
+            return Expect::KeyOrEnd;
+        case '[':
+            ++pos_;
+            containers_.push_back(']');
+            handler.startArray();
+            return Expect::ValueOrEnd;
+        case '"':
+            readString();
+            handler.string(buffer_);
+            return afterValue();
+        case 't':
+            readLiteral("true");
+            handler.boolean(true);
+            return afterValue();
+        case 'f':
+            readLiteral("false");
+            handler.boolean(false);
+            return afterValue();
+        case 'n':
+            readLiteral("null");
+            handler.null();
+            return afterValue();
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                size_t start = pos_;
+                readNumber();
+                handler.number(content_.data() + start, pos_ - start);
+                return afterValue();
+            }
+            fail(std::string("unexpected character '") + c + "'");
+        }
+    }
+
+    void readLiteral(const char* literal) {
+        for (const char* p = literal; *p; ++p, ++pos_) {
+            if (pos_ >= content_.size() || content_[pos_] != *p) fail("invalid literal");
+        }
+    }
+
+    // Validates the JSON number grammar; conversion is left to the handler
+    void readNumber() {
+        auto digits = [this]() {
+            size_t start = pos_;
+            while (pos_ < content_.size() && content_[pos_] >= '0' && content_[pos_] <= '9') ++pos_;
+            if (pos_ == start) fail("invalid number");
+        };
+
+        if (content_[pos_] == '-') ++pos_;
+        digits();
+        if (pos_ < content_.size() && content_[pos_] == '.') {
+            ++pos_;
+            digits();
+        }
+        if (pos_ < content_.size() && (content_[pos_] == 'e' || content_[pos_] == 'E')) {
+            ++pos_;
+            if (pos_ < content_.size() && (content_[pos_] == '+' || content_[pos_] == '-')) ++pos_;
+            digits();
+        }
+    }
+
+    // Reads a quoted string into buffer_, decoding escapes
+    void readString() {
+        buffer_.clear();
+        ++pos_;
+        while (true) {
+            if (pos_ >= content_.size()) fail("unterminated string");
+            char c = content_[pos_++];
+            if (c == '"') return;
+            if (c != '\\') {
+                buffer_ += c;
+                continue;
+            }
+
+            if (pos_ >= content_.size()) fail("unterminated string");
+            char escaped = content_[pos_++];
+            switch (escaped) {
+            case '"': buffer_ += '"'; break;
+            case '\\': buffer_ += '\\'; break;
+            case '/': buffer_ += '/'; break;
+            case 'b': buffer_ += '\b'; break;
+            case 'f': buffer_ += '\f'; break;
+            case 'n': buffer_ += '\n'; break;
+            case 'r': buffer_ += '\r'; break;
+            case 't': buffer_ += '\t'; break;
+            case 'u': appendCodePoint(); break;
+            default: fail("invalid escape sequence");
+            }
+        }
+    }
+
+    // \uXXXX escape as UTF-8 (surrogate pairs are not combined; keys never need them)
+    void appendCodePoint() {
+        if (pos_ + 4 > content_.size()) fail("truncated \\u escape");
+        unsigned code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char h = content_[pos_++];
+            code <<= 4;
+            if (h >= '0' && h <= '9') code |= h - '0';
+            else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+            else fail("invalid \\u escape");
+        }
+        if (code < 0x80) {
+            buffer_ += static_cast<char>(code);
+        } else if (code < 0x800) {
+            buffer_ += static_cast<char>(0xC0 | (code >> 6));
+            buffer_ += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            buffer_ += static_cast<char>(0xE0 | (code >> 12));
+            buffer_ += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            buffer_ += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+// Parser for our query format. Builds the operator tree from JsonSaxReader
+// events in a single pass, independent of whitespace and key order.
+// Nesting is only bounded by memory: the optimizer, interner and executors
+// walk the tree with explicit stacks too.
+class SimpleJsonParser {
+public:
+    static QueryTree parseQueryFile(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open query file: " + filename);
+        }
+
+        std::ostringstream content;
+        content << file.rdbuf();
+        return parseQueryString(content.str());
+    }
+
+    static QueryTree parseQueryString(const std::string& content) {
+        TreeBuilder builder;
+        JsonSaxReader::parse(content, builder);
+        return builder.finish();
+    }
+
+private:
+    // SAX handler. Every open JSON container has a frame saying what it means
+    // in the query grammar; containers we do not care about (valid_region,
+    // unknown keys) become Skip frames and their contents are ignored.
+    // Nodes are appended to the tree as their closing bracket is read, so
+    // children always precede their parent. The document's limit, offset and
+    // after cursor are collected into the tree's ResultPage, and an outermost
+    // operator_count / count_by_category / count_groups into its Aggregate.
+    class TreeBuilder {
+    public:
+        QueryTree finish() {
+            if (!has_root_) {
+                throw std::runtime_error("No query found in JSON");
+            }
+            tree_.setRoot(root_);
+            if (aggregate_ != Aggregate::None && page_.active()) {
+                throw std::runtime_error("limit, offset and after do not apply to aggregates");
+            }
+            tree_.setPage(page_);
+            tree_.setAggregate(aggregate_);
+            return std::move(tree_);
+        }
+
+        void startObject() {
+            Frame frame;
+            if (frames_.empty()) {
+                frame.kind = Kind::Document;
+            } else {
+                const Frame& parent = frames_.back();
+                if (parent.kind == Kind::Document && parent.key == "query") {
+                    frame.kind = Kind::Operator;
+                } else if (parent.kind == Kind::Operands) {
+                    frame.kind = Kind::Operator;
+                } else if (parent.kind == Kind::Operator && parent.key == "operator_crop") {
+                    frame.kind = Kind::Crop;
+                } else if (parent.kind == Kind::Operator && isAggregate(parent.key)) {
+                    // Aggregates wrap the whole operator tree
+                    if (frames_[frames_.size() - 2].kind != Kind::Document) {
+                        throw std::runtime_error(parent.key + " must be the outermost operator");
+                    }
+                    frame.kind = Kind::Operator;
+                    aggregate_ = aggregateOf(parent.key);
+                } else if (parent.kind == Kind::Crop && parent.key == "region") {
+                    frame.kind = Kind::Region;
+                } else if (parent.kind == Kind::Region && (parent.key == "p_min" || parent.key == "p_max")) {
+                    frame.kind = Kind::Point;
+                    frame.is_max = parent.key == "p_max";
+                } else if (parent.kind == Kind::Document && parent.key == "after") {
+                    frame.kind = Kind::Cursor;
+                    page_.has_after = true;
+                } else {
+                    frame.kind = Kind::Skip;
+                }
+            }
+            frames_.push_back(std::move(frame));
+        }
+
+        void endObject() {
+            Frame frame = std::move(frames_.back());
+            frames_.pop_back();
+
+            if (frame.kind == Kind::Operator) {
+                if (!frame.has_result) {
+                    throw std::runtime_error("Unknown operator in query");
+                }
+                Frame& parent = frames_.back();
+                if (parent.kind == Kind::Operands) {
+                    parent.children.push_back(frame.result);
+                } else if (parent.kind == Kind::Operator) {
+                    setResult(parent, frame.result);
+                } else {
+                    root_ = frame.result;
+                    has_root_ = true;
+                }
+            } else if (frame.kind == Kind::Crop) {
+                if (!frame.has_region) {
+                    throw std::runtime_error("operator_crop requires a region");
+                }
+                if (frame.corners != ALL_CORNERS) {
+                    throw std::runtime_error("operator_crop region requires p_min and p_max, each with x and y");
+                }
+                setResult(frames_.back(), tree_.addCrop(frame.params));
+            } else if (frame.kind == Kind::Region) {
+                frames_.back().has_region = true;
+            }
+        }
+
+        void startArray() {
+            Frame frame;
+            frame.kind = Kind::Skip;
+            if (!frames_.empty()) {
+                Frame& parent = frames_.back();
+                if (parent.kind == Kind::Operator && (parent.key == "operator_and" || parent.key == "operator_or")) {
+                    frame.kind = Kind::Operands;
+                    frame.is_and = parent.key == "operator_and";
+                } else if (parent.kind == Kind::Crop && parent.key == "one_of_groups") {
+                    frame.kind = Kind::Groups;
+                    parent.params.has_one_of_groups = true;
+                }
+            }
+            frames_.push_back(std::move(frame));
+        }
+
+        void endArray() {
+            Frame frame = std::move(frames_.back());
+            frames_.pop_back();
+
+            if (frame.kind == Kind::Operands) {
+                NodeId id = frame.is_and ? tree_.addAnd(frame.children) : tree_.addOr(frame.children);
+                setResult(frames_.back(), id);
+            }
+        }
+
+        void key(const std::string& name) {
+            Frame& frame = frames_.back();
+            if (frame.kind == Kind::Operator && frame.has_result) {
+                throw std::runtime_error("Operator object must contain exactly one operator");
+            }
+            frame.key = name;
+        }
+
+        // text points into the (NUL terminated) document and is a valid JSON
+        // number, so strtod/strtol stop exactly at its end
+        void number(const char* text, size_t length) {
+            if (frames_.empty()) return;
+            Frame& frame = frames_.back();
+
+            if (frame.kind == Kind::Point) {
+                Frame& crop = frames_[frames_.size() - 3];
+                Region& region = crop.params.region;
+                if (frame.key == "x") {
+                    (frame.is_max ? region.p_max_x : region.p_min_x) = std::strtod(text, nullptr);
+                    crop.corners |= frame.is_max ? MAX_X : MIN_X;
+                } else if (frame.key == "y") {
+                    (frame.is_max ? region.p_max_y : region.p_min_y) = std::strtod(text, nullptr);
+                    crop.corners |= frame.is_max ? MAX_Y : MIN_Y;
+                }
+            } else if (frame.kind == Kind::Crop && frame.key == "category") {
+                frame.params.has_category = true;
+                frame.params.category = static_cast<int>(std::strtol(text, nullptr, 10));
+            } else if (frame.kind == Kind::Groups) {
+                frames_[frames_.size() - 2].params.one_of_groups.push_back(std::strtol(text, nullptr, 10));
+            } else if (frame.kind == Kind::Cursor) {
+                if (frame.key == "x") page_.after_x = std::strtod(text, nullptr);
+                if (frame.key == "y") page_.after_y = std::strtod(text, nullptr);
+            } else if (frame.kind == Kind::Document && (frame.key == "limit" || frame.key == "offset")) {
+                // Digits only: strtoll would read 1e3 as 1 and 2.5 as 2. The
+                // SQL engine sends the value as a bigint, so it must fit one.
+                size_t value = 0;
+                if (!parseCount(std::string(text, length), value) ||
+                    value > static_cast<size_t>(std::numeric_limits<int64_t>::max())) {
+                    throw std::runtime_error(frame.key + " must be a non-negative integer");
+                }
+                if (frame.key == "limit") {
+                    page_.has_limit = true;
+                    page_.limit = value;
+                } else {
+                    page_.offset = value;
+                }
+            }
+        }
+
+        void boolean(bool value) {
+            if (frames_.empty()) return;
+            Frame& frame = frames_.back();
+            if (frame.kind == Kind::Crop && frame.key == "proper") {
+                frame.params.proper = value;
+            }
+        }
+
+        void string(const std::string&) {}
+        void null() {}
+
+    private:
+        enum class Kind { Document, Operator, Operands, Crop, Region, Point, Groups, Cursor, Skip };
+
+        // Region coordinates a Crop frame has read
+        static constexpr unsigned MIN_X = 1, MIN_Y = 2, MAX_X = 4, MAX_Y = 8;
+        static constexpr unsigned ALL_CORNERS = MIN_X | MIN_Y | MAX_X | MAX_Y;
+
+        struct Frame {
+            Kind kind = Kind::Skip;
+            std::string key;                 // last key seen in this object
+            CropParams params;               // Crop frames
+            unsigned corners = 0;            // Crop frames: coordinates read, see ALL_CORNERS
+            std::vector<NodeId> children;    // Operands frames
+            NodeId result = 0;               // Operator frames: the operator they hold
+            bool has_result = false;
+            bool has_region = false;
+            bool is_max = false;
+            bool is_and = false;
+        };
+
+        QueryTree tree_;
+        std::vector<Frame> frames_;
+        NodeId root_ = 0;
+        bool has_root_ = false;
+        ResultPage page_;
+        Aggregate aggregate_ = Aggregate::None;
+
+        static bool isAggregate(const std::string& key) {
+            return key == "operator_count" || key == "count_by_category" || key == "count_groups";
+        }
+
+        static Aggregate aggregateOf(const std::string& key) {
+            if (key == "count_by_category") return Aggregate::CountByCategory;
+            if (key == "count_groups") return Aggregate::CountGroups;
+            return Aggregate::Count;
+        }
+
+        static void setResult(Frame& operator_frame, NodeId id) {
+            operator_frame.result = id;
+            operator_frame.has_result = true;
+        }
+    };
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Collects a per-query execution trace for --profile: time per phase, and
+// for every operator node its wall time split into connect / sql / decode /
+// set_algebra, rows in and out, and the server's EXPLAIN (ANALYZE, BUFFERS)
+// output for each SQL statement it issued. The trace is written as JSON with
+// stable keys so two runs can be diffed directly.
+class QueryProfiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t NO_NODE = static_cast<size_t>(-1);
+
+    explicit QueryProfiler(bool enabled = false) : enabled_(enabled) {}
+
+    bool enabled() const { return enabled_; }
+
+    static double elapsedMs(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    void addPhase(const std::string& name, double ms) {
+        if (!enabled_) return;
+        phases_.push_back({name, ms});
+    }
+
+    // Opens a trace entry for an operator node; nested calls become children
+    size_t beginNode(long node, const std::string& type, const std::string& detail) {
+        if (!enabled_) return NO_NODE;
+        NodeEntry entry;
+        entry.node = node;
+        entry.type = type;
+        entry.detail = detail;
+        entry.parent = open_nodes_.empty() ? NO_NODE : open_nodes_.back();
+        entry.start = Clock::now();
+        nodes_.push_back(entry);
+        open_nodes_.push_back(nodes_.size() - 1);
+        return nodes_.size() - 1;
+    }
+
+    void endNode(size_t index, size_t rows_out, bool cached = false) {
+        if (index == NO_NODE) return;
+        NodeEntry& entry = nodes_[index];
+        entry.wall_ms = elapsedMs(entry.start) - entry.excluded_ms;
+        entry.rows_out = rows_out;
+        entry.cached = cached;
+        open_nodes_.pop_back();
+    }
+
+    // Rows consumed by the innermost open node (fetched from the server or
+    // produced by its operands)
+    void addRowsIn(size_t rows) {
+        if (!enabled_ || open_nodes_.empty()) return;
+        nodes_[open_nodes_.back()].rows_in += rows;
+    }
+
+    // Adds time spent in one step (connect, sql, decode, set_algebra) to the innermost open node
+    void addStep(const std::string& step, double ms) {
+        if (!enabled_ || open_nodes_.empty()) return;
+        nodes_[open_nodes_.back()].steps[step] += ms;
+    }
+
+    // Removes profiling overhead (the EXPLAIN re-runs) from the wall time of
+    // every open node, so wall_ms matches an unprofiled run
+    void excludeTime(double ms) {
+        if (!enabled_) return;
+        for (size_t index : open_nodes_) {
+            nodes_[index].excluded_ms += ms;
+        }
+    }
+
+    void addStatement(const std::string& sql, double ms, const std::string& explain_json) {
+        if (!enabled_ || open_nodes_.empty()) return;
+        std::string text = sql.size() > MAX_SQL_LENGTH ? sql.substr(0, MAX_SQL_LENGTH) + "..." : sql;
+        nodes_[open_nodes_.back()].statements.push_back({text, ms, explain_json});
+    }
+
+    bool writeTrace(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) return false;
+
+        file << "{\n  \"phases\": [";
+        for (size_t i = 0; i < phases_.size(); ++i) {
+            file << (i ? "," : "") << "\n    { \"name\": " << quote(phases_[i].name)
+                 << ", \"ms\": " << number(phases_[i].ms) << " }";
+        }
+        file << "\n  ],\n  \"nodes\": [";
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            const NodeEntry& entry = nodes_[i];
+            file << (i ? "," : "") << "\n    {\n"
+                 << "      \"index\": " << i << ",\n"
+                 << "      \"parent\": " << (entry.parent == NO_NODE ? std::string("null") : std::to_string(entry.parent)) << ",\n"
+                 << "      \"node\": " << entry.node << ",\n"
+                 << "      \"type\": " << quote(entry.type) << ",\n"
+                 << "      \"detail\": " << quote(entry.detail) << ",\n"
+                 << "      \"cached\": " << (entry.cached ? "true" : "false") << ",\n"
+                 << "      \"wall_ms\": " << number(entry.wall_ms) << ",\n"
+                 << "      \"rows_in\": " << entry.rows_in << ",\n"
+                 << "      \"rows_out\": " << entry.rows_out << ",\n"
+                 << "      \"steps_ms\": {";
+            bool first = true;
+            for (const auto& step : entry.steps) {
+                file << (first ? " " : ", ") << quote(step.first) << ": " << number(step.second);
+                first = false;
+            }
+            file << (first ? "}" : " }") << ",\n      \"statements\": [";
+            for (size_t s = 0; s < entry.statements.size(); ++s) {
+                const Statement& statement = entry.statements[s];
+                file << (s ? "," : "") << "\n        { \"sql\": " << quote(statement.sql)
+                     << ", \"ms\": " << number(statement.ms)
+                     << ", \"explain\": " << (statement.explain_json.empty() ? "null" : statement.explain_json) << " }";
+            }
+            file << (entry.statements.empty() ? "]" : "\n      ]") << "\n    }";
+        }
+        file << "\n  ]\n}\n";
+        return true;
+    }
+
+private:
+    static constexpr size_t MAX_SQL_LENGTH = 4096;
+
+    struct Phase {
+        std::string name;
+        double ms;
+    };
+
+    struct Statement {
+        std::string sql;
+        double ms;
+        std::string explain_json;   // EXPLAIN (..., FORMAT JSON) output, embedded verbatim
+    };
+
+    struct NodeEntry {
+        long node = -1;
+        std::string type;
+        std::string detail;
+        size_t parent = NO_NODE;
+        Clock::time_point start;
+        double wall_ms = 0.0;
+        double excluded_ms = 0.0;
+        size_t rows_in = 0;
+        size_t rows_out = 0;
+        bool cached = false;
+        std::map<std::string, double> steps;
+        std::vector<Statement> statements;
+    };
+
+    bool enabled_;
+    std::vector<Phase> phases_;
+    std::vector<NodeEntry> nodes_;
+    std::vector<size_t> open_nodes_;
+
+    static std::string number(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+        return buffer;
+    }
+
+    static std::string quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    quoted += buffer;
+                } else {
+                    quoted += c;
+                }
+            }
+        }
+        return quoted + "\"";
+    }
+};
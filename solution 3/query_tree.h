@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+
+struct Region {
+    double p_min_x, p_min_y, p_max_x, p_max_y;
+};
+
+struct CropParams {
+    Region region;
+    int category;
+    std::vector<long> one_of_groups;
+    bool proper;
+    bool has_category;
+    bool has_one_of_groups;
+
+    CropParams() : category(-1), proper(false), has_category(false), has_one_of_groups(false) {}
+};
+
+// Window of the (y, x) ordered result a query asks for: the points strictly
+// after the cursor, without the first offset of them, at most limit of them
+struct ResultPage {
+    bool has_limit = false;
+    size_t limit = 0;
+    size_t offset = 0;
+    bool has_after = false;
+    double after_x = 0.0;
+    double after_y = 0.0;
+
+    bool active() const { return has_limit || offset > 0 || has_after; }
+
+    // True when (x, y) comes strictly after the cursor in (y, x) order
+    bool isAfter(double x, double y) const {
+        return !has_after || y > after_y || (y == after_y && x > after_x);
+    }
+};
+
+// Aggregate a query may ask for instead of the points of its operator tree
+enum class Aggregate { None, Count, CountByCategory, CountGroups };
+
+// Operator nodes refer to each other by index into their QueryTree
+using NodeId = uint32_t;
+
+// Contiguous run of child ids in QueryTree's operand pool
+struct OperandRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Crop operation
+struct CropNode {
+    CropParams params;
+};
+
+// And operation
+struct AndNode {
+    OperandRange operands;
+};
+
+// Or operation
+struct OrNode {
+    OperandRange operands;
+};
+
+// Operation known to select nothing (produced by the optimizer)
+struct EmptyNode {};
+
+using QueryNode = std::variant<CropNode, AndNode, OrNode, EmptyNode>;
+
+// Builds a visitor for std::visit out of one lambda per node type
+template <typename... Visitors>
+struct Overloaded : Visitors... {
+    using Visitors::operator()...;
+};
+template <typename... Visitors>
+Overloaded(Visitors...) -> Overloaded<Visitors...>;
+
+// Arena holding a whole operator tree (or DAG, once subtrees are shared).
+// Nodes live in one vector and the operands of every AND/OR in another, so a
+// tree is two allocations regardless of its size, copying it is cheap and
+// nothing is reference counted. Children are always added before parents.
+class QueryTree {
+public:
+    // Read-only view over the operands of one AND/OR node
+    class Operands {
+    public:
+        Operands(const NodeId* first, uint32_t count) : first_(first), count_(count) {}
+        const NodeId* begin() const { return first_; }
+        const NodeId* end() const { return first_ + count_; }
+        size_t size() const { return count_; }
+        bool empty() const { return count_ == 0; }
+        NodeId operator[](size_t i) const { return first_[i]; }
+
+    private:
+        const NodeId* first_;
+        uint32_t count_;
+    };
+
+    NodeId addCrop(const CropParams& params) {
+        return add(CropNode{params});
+    }
+
+    NodeId addAnd(const std::vector<NodeId>& operands) {
+        return add(AndNode{addOperands(operands)});
+    }
+
+    NodeId addOr(const std::vector<NodeId>& operands) {
+        return add(OrNode{addOperands(operands)});
+    }
+
+    NodeId addEmpty() {
+        return add(EmptyNode{});
+    }
+
+    const QueryNode& node(NodeId id) const { return nodes_[id]; }
+    size_t size() const { return nodes_.size(); }
+
+    Operands operands(const OperandRange& range) const {
+        return Operands(operand_pool_.data() + range.first, range.count);
+    }
+
+    // Operands of an AND / OR node; none for crops and empty nodes
+    Operands children(NodeId id) const {
+        if (const auto* and_node = std::get_if<AndNode>(&nodes_[id])) return operands(and_node->operands);
+        if (const auto* or_node = std::get_if<OrNode>(&nodes_[id])) return operands(or_node->operands);
+        return Operands(nullptr, 0);
+    }
+
+    // Value of the subtree under id, computed bottom-up: evaluate(node, values)
+    // gets the values of node's operands in operand order (none for a crop or
+    // empty node) and returns node's own. The walk keeps its own stack, so
+    // depth is only bounded by memory; a node shared by several parents is
+    // evaluated once per parent, as a recursive walk would.
+    template <typename Value, typename Evaluate>
+    Value fold(NodeId id, Evaluate evaluate) const {
+        struct Frame {
+            NodeId id;
+            size_t next;          // operand to descend into next
+            size_t first_value;   // where the values of this node's operands start
+        };
+        std::vector<Frame> frames = {{id, 0, 0}};
+        std::vector<Value> values;
+        while (true) {
+            Frame& frame = frames.back();
+            Operands operands = children(frame.id);
+            if (frame.next < operands.size()) {
+                NodeId operand = operands[frame.next++];
+                frames.push_back({operand, 0, values.size()});
+                continue;
+            }
+            std::vector<Value> operand_values(std::make_move_iterator(values.begin() + frame.first_value),
+                                              std::make_move_iterator(values.end()));
+            values.erase(values.begin() + frame.first_value, values.end());
+            Value value = evaluate(frame.id, std::move(operand_values));
+            frames.pop_back();
+            if (frames.empty()) return value;
+            values.push_back(std::move(value));
+        }
+    }
+
+    NodeId root() const {
+        if (nodes_.empty()) throw std::runtime_error("Query tree is empty");
+        return root_;
+    }
+    void setRoot(NodeId id) { root_ = id; }
+
+    // Applies to the result of the whole tree, not to any node
+    const ResultPage& page() const { return page_; }
+    void setPage(const ResultPage& page) { page_ = page; }
+    Aggregate aggregate() const { return aggregate_; }
+    void setAggregate(Aggregate aggregate) { aggregate_ = aggregate; }
+
+    void reserve(size_t node_count) {
+        nodes_.reserve(node_count);
+        operand_pool_.reserve(node_count);
+    }
+
+private:
+    std::vector<QueryNode> nodes_;
+    std::vector<NodeId> operand_pool_;
+    NodeId root_ = 0;
+    ResultPage page_;
+    Aggregate aggregate_ = Aggregate::None;
+
+    NodeId add(QueryNode node) {
+        nodes_.push_back(std::move(node));
+        return static_cast<NodeId>(nodes_.size() - 1);
+    }
+
+    OperandRange addOperands(const std::vector<NodeId>& operands) {
+        OperandRange range{static_cast<uint32_t>(operand_pool_.size()), static_cast<uint32_t>(operands.size())};
+        operand_pool_.insert(operand_pool_.end(), operands.begin(), operands.end());
+        return range;
+    }
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Orders result points by (y, x). sortByYX, which the query programs call, is
+// a comparator std::sort: libstdc++'s introsort, the nearest this tree has to
+// pdqsort. radixSortByYX is a parallel LSD radix sort kept for bench_radix_sort
+// until it measurably beats std::sort, which on one thread it does not at any
+// size bench_radix_sort covers. It maps each coordinate to a 64-bit key whose
+// unsigned order is the numeric order of the double (sign bit flipped for
+// positives, all bits flipped for negatives) and sorts (key, index) pairs with
+// 11-bit digits: per pass every thread counts the digits of its chunk, a prefix
+// sum over (digit, thread) gives each thread its output slots, and the threads
+// scatter stably. The x digits are sorted first and the y digits last, so the
+// stable passes leave the indices in (y, x) order; passes whose digit is the
+// same for every key are skipped. The items are then permuted once through the
+// indices.
+class RadixSort {
+public:
+    // Key with the same unsigned order as value's numeric order; -0.0 is
+    // folded into 0.0 so the two tie, as they do under <
+    static uint64_t orderedBits(double value) {
+        if (value == 0.0) value = 0.0;
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits >> 63) ? ~bits : bits | (uint64_t(1) << 63);
+    }
+
+    // Sorts items by (y(item), x(item))
+    template <typename T, typename GetY, typename GetX>
+    static void sortByYX(std::vector<T>& items, GetY y, GetX x) {
+        std::sort(items.begin(), items.end(), [&y, &x](const T& a, const T& b) {
+            if (y(a) != y(b)) return y(a) < y(b);
+            return x(a) < x(b);
+        });
+    }
+
+    // Stable radix sort by (y(item), x(item)); at most UINT32_MAX items,
+    // threads == 0 uses every hardware thread
+    template <typename T, typename GetY, typename GetX>
+    static void radixSortByYX(std::vector<T>& items, GetY y, GetX x, size_t threads = 0) {
+        size_t count = items.size();
+
+        // Least significant key first: x, then y
+        std::vector<uint64_t> keys(count);
+        std::vector<uint64_t> y_keys(count);
+        std::vector<uint32_t> indices(count);
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = orderedBits(x(items[i]));
+            y_keys[i] = orderedBits(y(items[i]));
+            indices[i] = static_cast<uint32_t>(i);
+        }
+        sortKeys(keys, indices, threads);
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = y_keys[indices[i]];
+        }
+        sortKeys(keys, indices, threads);
+
+        // The gather is a random read per item, so fetch a few items ahead
+        std::vector<T> sorted;
+        sorted.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (i + PREFETCH_DISTANCE < count) __builtin_prefetch(&items[indices[i + PREFETCH_DISTANCE]]);
+            sorted.push_back(std::move(items[indices[i]]));
+        }
+        items.swap(sorted);
+    }
+
+    // Stable sort of keys ascending, carrying indices along
+    static void sortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& indices, size_t threads = 0) {
+        size_t count = keys.size();
+        size_t workers = workerCount(count, threads);
+
+        std::vector<uint64_t> key_buffer(count);
+        std::vector<uint32_t> index_buffer(count);
+        std::vector<size_t> counts(workers * BUCKETS);
+
+        for (int shift = 0; shift < 64; shift += DIGIT_BITS) {
+            // Per-thread digit counts of the current order
+            parallel(workers, [&](size_t t) {
+                size_t* local = &counts[t * BUCKETS];
+                std::fill(local, local + BUCKETS, 0);
+                for (size_t i = count * t / workers, end = count * (t + 1) / workers; i < end; ++i) {
+                    ++local[(keys[i] >> shift) & DIGIT_MASK];
+                }
+            });
+
+            // A digit shared by every key leaves the order unchanged
+            bool constant = false;
+            for (size_t digit = 0; digit < BUCKETS; ++digit) {
+                size_t total = 0;
+                for (size_t t = 0; t < workers; ++t) total += counts[t * BUCKETS + digit];
+                if (total != 0) {
+                    constant = total == count;
+                    break;
+                }
+            }
+            if (constant) continue;
+
+            // Digit-major, thread-minor prefix sum keeps the scatter stable
+            size_t offset = 0;
+            for (size_t digit = 0; digit < BUCKETS; ++digit) {
+                for (size_t t = 0; t < workers; ++t) {
+                    size_t n = counts[t * BUCKETS + digit];
+                    counts[t * BUCKETS + digit] = offset;
+                    offset += n;
+                }
+            }
+
+            parallel(workers, [&](size_t t) {
+                size_t* next = &counts[t * BUCKETS];
+                for (size_t i = count * t / workers, end = count * (t + 1) / workers; i < end; ++i) {
+                    size_t slot = next[(keys[i] >> shift) & DIGIT_MASK]++;
+                    key_buffer[slot] = keys[i];
+                    index_buffer[slot] = indices[i];
+                }
+            });
+            keys.swap(key_buffer);
+            indices.swap(index_buffer);
+        }
+    }
+
+private:
+    static constexpr int DIGIT_BITS = 11;
+    static constexpr size_t BUCKETS = size_t(1) << DIGIT_BITS;
+    static constexpr uint64_t DIGIT_MASK = BUCKETS - 1;
+    static constexpr size_t MIN_ITEMS_PER_THREAD = 65536;
+    static constexpr size_t PREFETCH_DISTANCE = 16;
+
+    static size_t workerCount(size_t count, size_t threads) {
+        if (threads == 0) threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        return std::max<size_t>(1, std::min(threads, count / MIN_ITEMS_PER_THREAD));
+    }
+
+    // Runs work(0 .. workers-1), all but the first on their own threads
+    template <typename Work>
+    static void parallel(size_t workers, Work work) {
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < workers; ++t) threads.emplace_back(work, t);
+        work(0);
+        for (auto& thread : threads) thread.join();
+    }
+};
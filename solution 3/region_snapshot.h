@@ -0,0 +1,401 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kd_tree.h"
+#include "postings_index.h"
+#include "region_store.h"
+
+// Binary snapshot of a RegionStore (columns and group stats) and optionally
+// its KD-tree and postings lists, laid out so the file can be mapped and used
+// in place. Page 0 holds a fixed header with a table of sections; every
+// section starts on a page boundary and is a raw native-endian array. The
+// header carries its own checksum and one per section. Opening maps the file
+// read-only and shared, checks the header and points the store's columns into
+// the mapping, so startup does not depend on the row count and any number of
+// processes share one copy in the page cache. The writer never modifies a file
+// in place: it writes a temporary file and renames it over the old one, so a
+// process that still maps the old snapshot keeps reading consistent data.
+class RegionSnapshot {
+public:
+    // Large enough for 4 KiB and 16 KiB pages
+    static constexpr size_t PAGE_SIZE = 16384;
+    static constexpr uint32_t VERSION = 1;
+
+    static void write(const std::string& path, const RegionStore& store, const KdTree* index = nullptr,
+                      const PostingsIndex* postings = nullptr) {
+        const auto& columns = store.columns();
+        std::vector<Source> sources = {
+            source(IDS, columns.ids),
+            source(GROUP_IDS, columns.group_ids),
+            source(GROUP_INDICES, columns.group_indices),
+            source(XS, columns.xs),
+            source(YS, columns.ys),
+            source(CATEGORIES, columns.categories),
+            source(GROUP_BOUNDS, columns.group_bounds),
+            source(GROUP_KEYS, columns.group_keys),
+        };
+        if (index) {
+            const auto& kd = index->columns();
+            sources.push_back(source(KD_MIN_X, kd.min_x));
+            sources.push_back(source(KD_MIN_Y, kd.min_y));
+            sources.push_back(source(KD_MAX_X, kd.max_x));
+            sources.push_back(source(KD_MAX_Y, kd.max_y));
+            sources.push_back(source(KD_XS, kd.xs));
+            sources.push_back(source(KD_YS, kd.ys));
+            sources.push_back(source(KD_ROWS, kd.rows));
+        }
+        if (postings) {
+            const auto& lists = postings->columns();
+            sources.push_back(source(CATEGORY_KEYS, lists.category_keys));
+            sources.push_back(source(CATEGORY_OFFSETS, lists.category_offsets));
+            sources.push_back(source(CATEGORY_YS, lists.category_ys));
+            sources.push_back(source(CATEGORY_XS, lists.category_xs));
+            sources.push_back(source(CATEGORY_ROWS, lists.category_rows));
+            sources.push_back(source(GROUP_OFFSETS, lists.group_offsets));
+            sources.push_back(source(GROUP_YS, lists.group_ys));
+            sources.push_back(source(GROUP_XS, lists.group_xs));
+            sources.push_back(source(GROUP_ROWS, lists.group_rows));
+        }
+
+        Header header = {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.page_size = PAGE_SIZE;
+        header.section_count = static_cast<uint32_t>(sources.size());
+        header.row_count = store.size();
+        header.group_count = store.groupCount();
+        header.kd_levels = index ? static_cast<uint32_t>(index->levels()) : NO_INDEX;
+        header.kd_fingerprint = index ? index->sourceFingerprint() : 0;
+
+        uint64_t offset = PAGE_SIZE;
+        for (size_t s = 0; s < sources.size(); ++s) {
+            Section& section = header.sections[s];
+            section.kind = sources[s].kind;
+            section.element_size = sources[s].element_size;
+            section.offset = offset;
+            section.count = sources[s].count;
+            section.checksum = checksum(sources[s].data, sources[s].bytes());
+            offset = alignUp(offset + sources[s].bytes());
+        }
+        header.header_checksum = checksum(&header, offsetof(Header, header_checksum));
+
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                throw std::runtime_error("Cannot write snapshot file: " + temporary);
+            }
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (size_t s = 0; s < sources.size(); ++s) {
+                pad(file, header.sections[s].offset);
+                file.write(static_cast<const char*>(sources[s].data), static_cast<std::streamsize>(sources[s].bytes()));
+            }
+            pad(file, offset);
+            if (!file.flush()) {
+                throw std::runtime_error("Cannot write snapshot file: " + temporary);
+            }
+        }
+        std::filesystem::rename(temporary, path);
+    }
+
+    // Maps path read-only. Throws when the file is missing, truncated, from
+    // another version or byte order, or its header checksum does not match.
+    // Section checksums are only compared by verify().
+    explicit RegionSnapshot(const std::string& path) : path_(path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open snapshot file: " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("Not a region snapshot: " + path);
+        }
+        bytes_ = static_cast<size_t>(info.st_size);
+        void* mapping = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("Cannot map snapshot file: " + path);
+        }
+        base_ = static_cast<const unsigned char*>(mapping);
+
+        try {
+            open();
+        } catch (...) {
+            ::munmap(const_cast<unsigned char*>(base_), bytes_);
+            throw;
+        }
+    }
+
+    ~RegionSnapshot() {
+        ::munmap(const_cast<unsigned char*>(base_), bytes_);
+    }
+
+    RegionSnapshot(const RegionSnapshot&) = delete;
+    RegionSnapshot& operator=(const RegionSnapshot&) = delete;
+
+    // Views into the mapping, valid while the snapshot lives
+    const RegionStore& store() const { return store_; }
+    size_t bytes() const { return bytes_; }
+
+    bool hasIndex() const { return header().kd_levels != NO_INDEX; }
+
+    // The stored KD-tree, built from store(), reading its arrays in place
+    // from the mapping; valid while the snapshot lives
+    KdTree index() const {
+        if (!hasIndex()) {
+            throw std::runtime_error("Snapshot has no KD-tree: " + path_);
+        }
+        const Header& h = header();
+        uint64_t node_count = (uint64_t(2) << h.kd_levels) - 1;
+        KdTree::Columns columns;
+        columns.min_x = column<double>(KD_MIN_X, node_count);
+        columns.min_y = column<double>(KD_MIN_Y, node_count);
+        columns.max_x = column<double>(KD_MAX_X, node_count);
+        columns.max_y = column<double>(KD_MAX_Y, node_count);
+        columns.xs = column<double>(KD_XS, h.row_count);
+        columns.ys = column<double>(KD_YS, h.row_count);
+        columns.rows = column<uint32_t>(KD_ROWS, h.row_count);
+        return KdTree::view(columns, static_cast<int>(h.kd_levels), h.kd_fingerprint);
+    }
+
+    bool hasPostings() const { return find(CATEGORY_KEYS) != nullptr; }
+
+    // The stored postings lists of store(), read in place from the mapping;
+    // valid while the snapshot lives
+    PostingsIndex postings() const {
+        if (!hasPostings()) {
+            throw std::runtime_error("Snapshot has no postings lists: " + path_);
+        }
+        return PostingsIndex::view(postingsColumns());
+    }
+
+    // Recomputes every section checksum; reads the whole file
+    void verify() const {
+        const Header& h = header();
+        for (uint32_t s = 0; s < h.section_count; ++s) {
+            const Section& section = h.sections[s];
+            if (checksum(base_ + section.offset, section.count * section.element_size) != section.checksum) {
+                throw std::runtime_error("Snapshot section " + std::to_string(section.kind) + " is corrupt: " + path_);
+            }
+        }
+    }
+
+private:
+    enum Kind : uint32_t {
+        IDS = 1,
+        GROUP_IDS,
+        GROUP_INDICES,
+        XS,
+        YS,
+        CATEGORIES,
+        GROUP_BOUNDS,
+        GROUP_KEYS,
+        KD_MIN_X,
+        KD_MIN_Y,
+        KD_MAX_X,
+        KD_MAX_Y,
+        KD_XS,
+        KD_YS,
+        KD_ROWS,
+        CATEGORY_KEYS,
+        CATEGORY_OFFSETS,
+        CATEGORY_YS,
+        CATEGORY_XS,
+        CATEGORY_ROWS,
+        GROUP_OFFSETS,
+        GROUP_YS,
+        GROUP_XS,
+        GROUP_ROWS,
+    };
+
+    static constexpr char MAGIC[8] = {'R', 'G', 'N', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static constexpr uint32_t NO_INDEX = UINT32_MAX;
+    static constexpr size_t MAX_SECTIONS = 32;
+    static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+    static constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+    struct Section {
+        uint32_t kind;
+        uint32_t element_size;
+        uint64_t offset;      // from the start of the file, a multiple of PAGE_SIZE
+        uint64_t count;       // elements
+        uint64_t checksum;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t page_size;
+        uint32_t section_count;
+        uint64_t row_count;
+        uint64_t group_count;
+        uint32_t kd_levels;   // NO_INDEX when the snapshot has no KD-tree
+        uint32_t reserved;
+        uint64_t kd_fingerprint;
+        Section sections[MAX_SECTIONS];
+        uint64_t header_checksum;   // over every byte before it
+    };
+
+    static_assert(sizeof(Header) <= PAGE_SIZE, "snapshot header must fit in the first page");
+    static_assert(sizeof(long) == 8, "snapshot columns store long as 64 bits");
+
+    struct Source {
+        uint32_t kind;
+        uint32_t element_size;
+        const void* data;
+        uint64_t count;
+
+        size_t bytes() const { return static_cast<size_t>(count) * element_size; }
+    };
+
+    std::string path_;
+    const unsigned char* base_ = nullptr;
+    size_t bytes_ = 0;
+    RegionStore store_;
+
+    template <typename Container>
+    static Source source(uint32_t kind, const Container& column) {
+        return {kind, static_cast<uint32_t>(sizeof(*column.data())), column.data(), column.size()};
+    }
+
+    static uint64_t alignUp(uint64_t offset) {
+        return (offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    }
+
+    static void pad(std::ofstream& file, uint64_t offset) {
+        static const char zeros[PAGE_SIZE] = {};
+        uint64_t position = static_cast<uint64_t>(file.tellp());
+        file.write(zeros, static_cast<std::streamsize>(offset - position));
+    }
+
+    // FNV-1a over 64-bit words, then the trailing bytes
+    static uint64_t checksum(const void* data, size_t bytes) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        uint64_t hash = FNV_OFFSET;
+        size_t i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, p + i, sizeof(word));
+            hash = (hash ^ word) * FNV_PRIME;
+        }
+        for (; i < bytes; ++i) {
+            hash = (hash ^ p[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(base_); }
+
+    const Section* find(uint32_t kind) const {
+        const Header& h = header();
+        for (uint32_t s = 0; s < h.section_count; ++s) {
+            if (h.sections[s].kind == kind) return &h.sections[s];
+        }
+        return nullptr;
+    }
+
+    // Typed view of a section that must hold count elements of T
+    template <typename T>
+    Column<T> column(uint32_t kind, uint64_t count) const {
+        const Section* section = find(kind);
+        if (!section || section->element_size != sizeof(T) || section->count != count) {
+            throw std::runtime_error("Snapshot section " + std::to_string(kind) + " is missing or malformed: " + path_);
+        }
+        return {reinterpret_cast<const T*>(base_ + section->offset), section->count};
+    }
+
+    static bool validOffsets(const Column<uint64_t>& offsets, uint64_t total) {
+        if (offsets[0] != 0 || offsets[offsets.size() - 1] != total) return false;
+        for (size_t i = 1; i < offsets.size(); ++i) {
+            if (offsets[i] < offsets[i - 1]) return false;
+        }
+        return true;
+    }
+
+    PostingsIndex::Columns postingsColumns() const {
+        const Header& h = header();
+        const Section* keys = find(CATEGORY_KEYS);
+        PostingsIndex::Columns columns;
+        columns.category_keys = column<int>(CATEGORY_KEYS, keys->count);
+        columns.category_offsets = column<uint64_t>(CATEGORY_OFFSETS, keys->count + 1);
+        columns.category_ys = column<double>(CATEGORY_YS, h.row_count);
+        columns.category_xs = column<double>(CATEGORY_XS, h.row_count);
+        columns.category_rows = column<uint32_t>(CATEGORY_ROWS, h.row_count);
+        columns.group_offsets = column<uint64_t>(GROUP_OFFSETS, h.group_count + 1);
+        columns.group_ys = column<double>(GROUP_YS, h.row_count);
+        columns.group_xs = column<double>(GROUP_XS, h.row_count);
+        columns.group_rows = column<uint32_t>(GROUP_ROWS, h.row_count);
+        return columns;
+    }
+
+    void open() {
+        const Header& h = header();
+        if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION) {
+            throw std::runtime_error("Not a region snapshot of version " + std::to_string(VERSION) + ": " + path_);
+        }
+        if (h.byte_order != BYTE_ORDER_MARK || h.page_size != PAGE_SIZE) {
+            throw std::runtime_error("Snapshot was written on an incompatible machine: " + path_);
+        }
+        if (h.section_count > MAX_SECTIONS || checksum(&h, offsetof(Header, header_checksum)) != h.header_checksum) {
+            throw std::runtime_error("Snapshot header is corrupt: " + path_);
+        }
+        for (uint32_t s = 0; s < h.section_count; ++s) {
+            const Section& section = h.sections[s];
+            if (section.offset % PAGE_SIZE != 0 || section.offset > bytes_ || section.count > bytes_ ||
+                section.count * section.element_size > bytes_ - section.offset) {
+                throw std::runtime_error("Snapshot file is truncated: " + path_);
+            }
+        }
+
+        RegionStore::Columns columns;
+        columns.ids = column<long>(IDS, h.row_count);
+        columns.group_ids = column<long>(GROUP_IDS, h.row_count);
+        columns.group_indices = column<uint32_t>(GROUP_INDICES, h.row_count);
+        columns.xs = column<double>(XS, h.row_count);
+        columns.ys = column<double>(YS, h.row_count);
+        columns.categories = column<int>(CATEGORIES, h.row_count);
+        columns.group_bounds = column<RegionStore::GroupBounds>(GROUP_BOUNDS, h.group_count);
+        columns.group_keys = column<long>(GROUP_KEYS, h.group_count);
+
+        if (hasIndex()) {
+            if (h.kd_levels >= 32) {
+                throw std::runtime_error("Snapshot KD-tree is malformed: " + path_);
+            }
+            uint64_t node_count = (uint64_t(2) << h.kd_levels) - 1;
+            column<double>(KD_MIN_X, node_count);
+            column<double>(KD_MIN_Y, node_count);
+            column<double>(KD_MAX_X, node_count);
+            column<double>(KD_MAX_Y, node_count);
+            column<double>(KD_XS, h.row_count);
+            column<double>(KD_YS, h.row_count);
+            column<uint32_t>(KD_ROWS, h.row_count);
+        }
+        if (hasPostings()) {
+            // Lists are read through their offsets, so these must run from 0
+            // to the row count without going back before anything uses them
+            PostingsIndex::Columns lists = postingsColumns();
+            if (!validOffsets(lists.category_offsets, h.row_count) || !validOffsets(lists.group_offsets, h.row_count)) {
+                throw std::runtime_error("Snapshot postings lists are malformed: " + path_);
+            }
+        }
+
+        store_ = RegionStore::view(columns);
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Read-only view of one column. Points into the RegionStore's own vectors or
+// into memory owned elsewhere, such as a mapped snapshot file.
+template <typename T>
+class Column {
+public:
+    Column() = default;
+    Column(const T* data, size_t size) : data_(data), size_(size) {}
+
+    const T* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    const T& operator[](size_t i) const { return data_[i]; }
+
+private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Column-oriented in-memory copy of the inspection_region table.
+// Row i of every column describes the same region. Groups are renumbered
+// densely (0..groupCount()-1) so per-group data can live in flat arrays.
+// A store either owns its columns (filled with append) or views columns kept
+// alive by someone else (see view()); stores move but never copy, since the
+// views point into the owned vectors. The store tracks whether its rows are in
+// ascending (y, x) order with ties by id, the order results are written and
+// paged in: then any subset taken in row order is already sorted.
+class RegionStore {
+public:
+    struct GroupBounds {
+        double min_x, min_y, max_x, max_y;
+    };
+
+    // Every column of a store, as views
+    struct Columns {
+        Column<long> ids;
+        Column<long> group_ids;
+        Column<uint32_t> group_indices;
+        Column<double> xs;
+        Column<double> ys;
+        Column<int> categories;
+        Column<GroupBounds> group_bounds;   // indexed by dense group index
+        Column<long> group_keys;            // group id of each dense group index
+    };
+
+    RegionStore() = default;
+    RegionStore(RegionStore&&) = default;
+    RegionStore& operator=(RegionStore&&) = default;
+    RegionStore(const RegionStore&) = delete;
+    RegionStore& operator=(const RegionStore&) = delete;
+
+    // Store over columns owned elsewhere, which must outlive it. Only the
+    // group id lookup, the extent (from the group bounds) and the order flag
+    // are computed; the columns are used in place.
+    static RegionStore view(const Columns& columns) {
+        RegionStore store;
+        store.columns_ = columns;
+        store.group_lookup_.reserve(columns.group_keys.size());
+        for (uint32_t group = 0; group < columns.group_keys.size(); ++group) {
+            store.group_lookup_.emplace(columns.group_keys[group], group);
+            store.extend(columns.group_bounds[group], group == 0);
+        }
+        for (size_t i = 1; i < columns.ids.size() && store.sorted_yx_; ++i) {
+            store.sorted_yx_ = !yxIdBefore(columns.xs[i], columns.ys[i], columns.ids[i],
+                                           columns.xs[i - 1], columns.ys[i - 1], columns.ids[i - 1]);
+        }
+        return store;
+    }
+
+    const Columns& columns() const { return columns_; }
+
+    void reserve(size_t count) {
+        ids_.reserve(count);
+        group_ids_.reserve(count);
+        group_indices_.reserve(count);
+        xs_.reserve(count);
+        ys_.reserve(count);
+        categories_.reserve(count);
+        refreshColumns();
+    }
+
+    void append(long id, long group_id, double x, double y, int category) {
+        uint32_t group_index;
+        auto it = group_lookup_.find(group_id);
+        if (it == group_lookup_.end()) {
+            group_index = static_cast<uint32_t>(group_bounds_.size());
+            group_lookup_.emplace(group_id, group_index);
+            group_bounds_.push_back({x, y, x, y});
+            group_keys_.push_back(group_id);
+        } else {
+            group_index = it->second;
+            GroupBounds& bounds = group_bounds_[group_index];
+            bounds.min_x = std::min(bounds.min_x, x);
+            bounds.min_y = std::min(bounds.min_y, y);
+            bounds.max_x = std::max(bounds.max_x, x);
+            bounds.max_y = std::max(bounds.max_y, y);
+        }
+
+        extend({x, y, x, y}, ids_.empty());
+        if (!ids_.empty() && yxIdBefore(x, y, id, xs_.back(), ys_.back(), ids_.back())) {
+            sorted_yx_ = false;
+        }
+        ids_.push_back(id);
+        group_ids_.push_back(group_id);
+        group_indices_.push_back(group_index);
+        xs_.push_back(x);
+        ys_.push_back(y);
+        categories_.push_back(category);
+        refreshColumns();
+    }
+
+    size_t size() const { return columns_.ids.size(); }
+    bool sortedByYX() const { return sorted_yx_; }
+    size_t groupCount() const { return columns_.group_bounds.size(); }
+    // Bounding box of every point; meaningless for an empty store
+    const GroupBounds& extent() const { return extent_; }
+
+    const Column<long>& ids() const { return columns_.ids; }
+    const Column<long>& groupIds() const { return columns_.group_ids; }
+    const Column<uint32_t>& groupIndices() const { return columns_.group_indices; }
+    const Column<double>& xs() const { return columns_.xs; }
+    const Column<double>& ys() const { return columns_.ys; }
+    const Column<int>& categories() const { return columns_.categories; }
+
+    const GroupBounds& groupBounds(uint32_t group_index) const { return columns_.group_bounds[group_index]; }
+    long groupKey(uint32_t group_index) const { return columns_.group_keys[group_index]; }
+
+    // Dense index of a group id, or -1 when no region belongs to that group
+    int64_t findGroup(long group_id) const {
+        auto it = group_lookup_.find(group_id);
+        return it == group_lookup_.end() ? -1 : static_cast<int64_t>(it->second);
+    }
+
+    // Strict (y, x) order, the order results are written in
+    static bool yxBefore(double x, double y, double other_x, double other_y) {
+        return y < other_y || (y == other_y && x < other_x);
+    }
+
+    // (y, x) order with ties by id, as in SQL's ORDER BY coord_y, coord_x, id,
+    // so pages of both engines hold the same rows
+    static bool yxIdBefore(double x, double y, long id, double other_x, double other_y, long other_id) {
+        return y < other_y || (y == other_y && (x < other_x || (x == other_x && id < other_id)));
+    }
+
+private:
+    Columns columns_;
+    GroupBounds extent_ = {0.0, 0.0, 0.0, 0.0};
+    bool sorted_yx_ = true;
+
+    // Owned storage behind columns_ for stores filled with append
+    std::vector<long> ids_;
+    std::vector<long> group_ids_;
+    std::vector<uint32_t> group_indices_;
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+    std::vector<int> categories_;
+
+    std::unordered_map<long, uint32_t> group_lookup_;
+    std::vector<GroupBounds> group_bounds_;
+    std::vector<long> group_keys_;
+
+    // Grows extent_ over bounds, or starts it there when first is set
+    void extend(const GroupBounds& bounds, bool first) {
+        if (first) {
+            extent_ = bounds;
+            return;
+        }
+        extent_.min_x = std::min(extent_.min_x, bounds.min_x);
+        extent_.min_y = std::min(extent_.min_y, bounds.min_y);
+        extent_.max_x = std::max(extent_.max_x, bounds.max_x);
+        extent_.max_y = std::max(extent_.max_y, bounds.max_y);
+    }
+
+    void refreshColumns() {
+        columns_.ids = {ids_.data(), ids_.size()};
+        columns_.group_ids = {group_ids_.data(), group_ids_.size()};
+        columns_.group_indices = {group_indices_.data(), group_indices_.size()};
+        columns_.xs = {xs_.data(), xs_.size()};
+        columns_.ys = {ys_.data(), ys_.size()};
+        columns_.categories = {categories_.data(), categories_.size()};
+        columns_.group_bounds = {group_bounds_.data(), group_bounds_.size()};
+        columns_.group_keys = {group_keys_.data(), group_keys_.size()};
+    }
+};
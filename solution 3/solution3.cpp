@@ -1,285 +1,940 @@
 #include <iostream>
 #include <fstream>
+#include <filesystem>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <set>
+#include <unordered_map>
+#include <memory>
+#include <queue>
+#include <functional>
+#include <sstream>
 #include <pqxx/pqxx>
 
-// Simple JSON parser for our specific format
-class SimpleJsonParser {
-public:
-    struct Region {
-        double p_min_x, p_min_y, p_max_x, p_max_y;
-    };
+#include "columnar_output.h"
+#include "compiled_predicate.h"
+#include "crop_kernel.h"
+#include "grid_index.h"
+#include "hilbert_key.h"
+#include "hilbert_rtree.h"
+#include "kd_tree.h"
+#include "morsel_executor.h"
+#include "parse_count.h"
+#include "postings_index.h"
+#include "query_optimizer.h"
+#include "query_parser.h"
+#include "query_profiler.h"
+#include "quantized_columns.h"
+#include "radix_sort.h"
+#include "region_snapshot.h"
+#include "region_store.h"
+
+struct InspectionPoint {
+    long id;
+    long group_id;
+    double x;
+    double y;
+    int category;
     
-    struct CropParams {
-        Region region;
-        int category;
-        std::vector<long> one_of_groups;
-        bool proper;
-        bool has_category;
-        bool has_one_of_groups;
-        
-        CropParams() : category(-1), proper(false), has_category(false), has_one_of_groups(false) {}
-    };
+    // For sorting: by y then x
+    bool operator<(const InspectionPoint& other) const {
+        if (y < other.y) return true;
+        if (y > other.y) return false;
+        return x < other.x;
+    }
+    
+    // For set operations
+    bool operator==(const InspectionPoint& other) const {
+        return id == other.id;
+    }
+};
+
+// Hash function for InspectionPoint (for set operations)
+struct InspectionPointHash {
+    std::size_t operator()(const InspectionPoint& p) const {
+        return std::hash<long>()(p.id);
+    }
+};
+
+// One line of an aggregate result: the count, and the category it belongs to
+// for count_by_category
+struct AggregateRow {
+    long key;
+    long count;
+};
+
+// Command line switches that change how a query is planned
+struct QueryOptions {
+    bool optimize = true;
+    bool print_plan = false;
+    std::string engine = "sql";   // "sql" or "memory"
+    bool share_subtrees = true;
+    bool pipeline = true;         // send the SQL engine's crop leaves as one pqxx::pipeline
+    bool key_ranges = true;       // add Hilbert key ranges to crop SQL when the table is clustered
+    std::string profile_file;     // JSON trace destination, empty when not profiling
+    std::string index = "none";   // spatial index narrowing the memory engine's scan: "none", "kdtree", "rtree" or "grid"
+    std::string index_file;       // where a built KD-tree is saved and reloaded from, empty to always rebuild
+    std::string columns = "double";   // coordinates the full scan reads: "double", "float32" or "fixed32"
+    std::string layout = "table"; // row order of the memory engine's store: "table" or "yx" (sorted by y, then x)
+    size_t threads = 0;           // workers of the memory engine's scans, 0 for every hardware thread
+    std::string snapshot_file;    // mapped instead of reading the table, empty to read inspection_region
+    bool verify_snapshot = false; // check every section checksum of the snapshot before using it
+    std::string output_format = "text";   // "text" (x y lines) or "columnar" (binary, see ColumnarOutput)
+    std::vector<std::string> output_fields = {"x", "y"};   // columns of the columnar output, in order
+};
+
+class RegionQuery {
+private:
+    std::string connection_string_;
+    QueryOptions options_;
     
-    // Base class for all query operations
-    struct QueryOperation {
-        virtual ~QueryOperation() = default;
-    };
+    // Results of operator nodes with several parents, kept for one query
+    std::vector<bool> shared_nodes_;
+    std::unordered_map<NodeId, std::vector<InspectionPoint>> memo_;
     
-    // Crop operation
-    struct CropOperation : QueryOperation {
-        CropParams params;
-    };
+    // Points of crop leaves fetched ahead through the pipeline, taken on first use
+    std::unordered_map<NodeId, std::vector<InspectionPoint>> prefetched_;
+    size_t evaluations_ = 0;
+    size_t cache_hits_ = 0;
     
-    // And operation
-    struct AndOperation : QueryOperation {
-        std::vector<std::shared_ptr<QueryOperation>> operands;
-    };
+    QueryProfiler profiler_;
     
-    // Or operation  
-    struct OrOperation : QueryOperation {
-        std::vector<std::shared_ptr<QueryOperation>> operands;
-    };
+    // Mapped region snapshot backing the memory engine's store, when one is used
+    std::unique_ptr<RegionSnapshot> snapshot_;
     
-    static std::shared_ptr<QueryOperation> parseQueryFile(const std::string& filename) {
-        std::ifstream file(filename);
-        std::string line;
-        std::string content;
-        
-        while (std::getline(file, line)) {
-            content += line;
-        }
-        
-        // Find the main query object
-        size_t query_start = content.find("\"query\":");
-        if (query_start == std::string::npos) {
-            throw std::runtime_error("No query found in JSON");
+    // Curve the loader clustered inspection_region by, when it did
+    std::unique_ptr<HilbertKey> curve_;
+    
+public:
+    RegionQuery(const std::string& conn_str, const QueryOptions& options = QueryOptions())
+        : connection_string_(conn_str), options_(options), profiler_(!options.profile_file.empty()) {}
+    
+    bool executeQuery(const std::string& query_file, const std::string& output_file) {
+        try {
+            // Parse JSON query
+            auto phase_start = QueryProfiler::Clock::now();
+            QueryTree tree = SimpleJsonParser::parseQueryFile(query_file);
+            profiler_.addPhase("parse", QueryProfiler::elapsedMs(phase_start));
+            
+            // Rewrite the operator tree before touching the database
+            phase_start = QueryProfiler::Clock::now();
+            if (options_.print_plan) {
+                std::cout << "Plan before optimization:\n" << QueryOptimizer::describe(tree);
+            }
+            if (options_.optimize) {
+                tree = QueryOptimizer::optimize(tree);
+                if (options_.print_plan) {
+                    std::cout << "Plan after optimization:\n" << QueryOptimizer::describe(tree);
+                }
+            }
+            
+            profiler_.addPhase("optimize", QueryProfiler::elapsedMs(phase_start));
+            
+            // Share identical subtrees so each one is evaluated only once
+            phase_start = QueryProfiler::Clock::now();
+            shared_nodes_.clear();
+            memo_.clear();
+            evaluations_ = 0;
+            cache_hits_ = 0;
+            if (options_.share_subtrees) {
+                QueryInterner interner;
+                tree = interner.intern(tree);
+                shared_nodes_ = interner.sharedNodes();
+                std::cout << "Shared " << interner.duplicateCount() << " duplicate subtrees across "
+                          << std::count(shared_nodes_.begin(), shared_nodes_.end(), true) << " nodes" << std::endl;
+            }
+            
+            profiler_.addPhase("share_subtrees", QueryProfiler::elapsedMs(phase_start));
+            
+            if (tree.aggregate() != Aggregate::None) {
+                return executeAggregate(tree, output_file);
+            }
+            
+            // Execute query against database, or scan an in-memory copy once
+            phase_start = QueryProfiler::Clock::now();
+            // The root's statement applies the page and returns its rows in (y, x) order
+            bool ordered = tree.page().active();
+            if (options_.engine != "memory") {
+                loadCurve();
+                if (options_.pipeline) {
+                    prefetchCropLeaves(tree);
+                }
+            }
+            auto points = options_.engine == "memory" ? executeInMemory(tree, ordered)
+                                                      : executeOperation(tree, tree.root(), tree.page());
+            if (options_.engine != "memory" && options_.share_subtrees) {
+                std::cout << "Evaluated " << evaluations_ << " operator nodes, saved "
+                          << cache_hits_ << " evaluations through the result cache" << std::endl;
+            }
+            memo_.clear();
+            prefetched_.clear();
+            profiler_.addPhase("execute", QueryProfiler::elapsedMs(phase_start));
+            
+            // Sort points by (y, x), unless they came out of a (y, x) sorted store in row order
+            phase_start = QueryProfiler::Clock::now();
+            if (ordered) {
+                std::cout << "Result already in (y, x) order, final sort skipped" << std::endl;
+            } else {
+                RadixSort::sortByYX(points, [](const InspectionPoint& p) { return p.y; },
+                                    [](const InspectionPoint& p) { return p.x; });
+            }
+            profiler_.addPhase("sort", QueryProfiler::elapsedMs(phase_start));
+            
+            // Write output file
+            phase_start = QueryProfiler::Clock::now();
+            bool written = writeOutputFile(output_file, points);
+            profiler_.addPhase("output", QueryProfiler::elapsedMs(phase_start));
+            
+            return writeProfile() && written;
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Error executing query: " << e.what() << std::endl;
+            return false;
         }
-        
-        return parseOperation(content, query_start + 8); // Skip "\"query\":"
     }
     
 private:
-    static std::shared_ptr<QueryOperation> parseOperation(const std::string& content, size_t start_pos) {
-        // Find which operator we have
-        if (content.find("\"operator_crop\"", start_pos) != std::string::npos) {
-            return parseCropOperation(content, start_pos);
-        } else if (content.find("\"operator_and\"", start_pos) != std::string::npos) {
-            return parseAndOperation(content, start_pos);
-        } else if (content.find("\"operator_or\"", start_pos) != std::string::npos) {
-            return parseOrOperation(content, start_pos);
-        } else {
-            throw std::runtime_error("Unknown operator in query");
+    bool writeProfile() {
+        if (profiler_.enabled()) {
+            if (!profiler_.writeTrace(options_.profile_file)) {
+                std::cerr << "Cannot write profile trace: " << options_.profile_file << std::endl;
+                return false;
+            }
+            std::cout << "Profile trace written to: " << options_.profile_file << std::endl;
         }
+        return true;
     }
     
-    static std::shared_ptr<CropOperation> parseCropOperation(const std::string& content, size_t start_pos) {
-        auto crop_op = std::make_shared<CropOperation>();
-        
-        size_t pos = content.find("\"operator_crop\"", start_pos) + 15;
+    // Counts instead of points: the server answers with COUNT / GROUP BY rows,
+    // or the memory engine counts its selection, and no point is materialized,
+    // sorted or written
+    bool executeAggregate(const QueryTree& tree, const std::string& output_file) {
+        auto phase_start = QueryProfiler::Clock::now();
+        std::vector<AggregateRow> counts;
+        if (options_.engine == "memory") {
+            bool ordered = false;
+            executeInMemory(tree, ordered, &counts);
+        } else {
+            loadCurve();
+            if (options_.pipeline) {
+                prefetchCropLeaves(tree);
+            }
+            counts = executeAggregateOperation(tree);
+        }
+        memo_.clear();
+        prefetched_.clear();
+        profiler_.addPhase("execute", QueryProfiler::elapsedMs(phase_start));
         
-        // Extract region coordinates
-        crop_op->params.region.p_min_x = extractDouble(content, "\"p_min\": { \"x\":", pos);
-        crop_op->params.region.p_min_y = extractDouble(content, "\"y\":", pos);
-        crop_op->params.region.p_max_x = extractDouble(content, "\"p_max\": { \"x\":", pos);
-        crop_op->params.region.p_max_y = extractDouble(content, "\"y\":", pos);
+        phase_start = QueryProfiler::Clock::now();
+        bool written = writeCounts(output_file, tree.aggregate(), counts);
+        profiler_.addPhase("output", QueryProfiler::elapsedMs(phase_start));
         
-        // Extract category if present
-        size_t category_pos = content.find("\"category\":", pos);
-        if (category_pos != std::string::npos && category_pos < content.find("}", pos)) {
-            crop_op->params.has_category = true;
-            size_t start = content.find(":", category_pos) + 1;
-            size_t end = content.find_first_of(",}", start);
-            std::string cat_str = content.substr(start, end - start);
-            crop_op->params.category = std::stoi(cat_str);
+        return writeProfile() && written;
+    }
+    
+    // Candidate lists with more ascending runs than this are sorted instead of merged
+    static constexpr size_t MAX_MERGE_RUNS = 64;
+    
+    // Sets ordered when the points are returned in (y, x) order. For an
+    // aggregate query the counts go to counts and no points are returned.
+    std::vector<InspectionPoint> executeInMemory(const QueryTree& tree, bool& ordered,
+                                                 std::vector<AggregateRow>* counts = nullptr) {
+        // The whole tree runs as one scan, so it is traced as a single node
+        size_t trace = profiler_.beginNode(tree.root(), "COMPILED_SCAN", QueryOptimizer::label(tree, tree.root()));
+        RegionStore loaded;
+        if (options_.snapshot_file.empty()) {
+            loaded = loadRegionStore();
+        } else {
+            openSnapshot();
         }
+        const RegionStore& store = snapshot_ ? snapshot_->store() : loaded;
+        profiler_.addRowsIn(store.size());
+        MorselExecutor executor(options_.threads);
+        const ResultPage& page = tree.page();
+        
+        auto step_start = QueryProfiler::Clock::now();
+        CompiledPredicate predicate(tree, store);
+        profiler_.addStep("compile", QueryProfiler::elapsedMs(step_start));
+        std::cout << "Compiled predicate: " << predicate.leafCount() << " crops, "
+                  << predicate.bitsetCount() << " group bitsets" << std::endl;
         
-        // Extract one_of_groups if present
-        size_t groups_pos = content.find("\"one_of_groups\":", pos);
-        if (groups_pos != std::string::npos && groups_pos < content.find("}", pos)) {
-            crop_op->params.has_one_of_groups = true;
-            size_t start = content.find("[", groups_pos) + 1;
-            size_t end = content.find("]", start);
-            std::string groups_str = content.substr(start, end - start);
+        std::vector<size_t> rows;
+        size_t matched = 0;   // operator_count: the rows are only counted
+        Region bounds;
+        if (!QueryOptimizer::boundingRegion(tree, tree.root(), bounds)) {
+            std::cout << "Plan selects nothing" << std::endl;
+        } else {
+            // Start from the category / group postings when they hold fewer
+            // rows than the spatial path would test. Both sides count the
+            // build of an index the query would have to make first; postings
+            // not in the snapshot are only built when that alone is cheaper.
+            double spatial_rows = spatialEstimate(store, bounds);
+            double postings_rows = PostingsIndex::UNBOUNDED;
+            PostingsIndex postings;
+            if (hasPostingsFilter(tree)) {
+                step_start = QueryProfiler::Clock::now();
+                if (snapshot_ && snapshot_->hasPostings()) {
+                    postings = snapshot_->postings();
+                    postings_rows = postings.estimate(store, tree, tree.root());
+                    profiler_.addStep("postings_load", QueryProfiler::elapsedMs(step_start));
+                } else if (PostingsIndex::buildCost(store) < spatial_rows) {
+                    postings = PostingsIndex(store);
+                    postings_rows = postings.estimate(store, tree, tree.root());
+                    profiler_.addStep("postings_build", QueryProfiler::elapsedMs(step_start));
+                }
+            }
             
-            // Parse comma-separated group IDs
-            size_t group_start = 0;
-            while (group_start < groups_str.length()) {
-                size_t group_end = groups_str.find(",", group_start);
-                if (group_end == std::string::npos) group_end = groups_str.length();
-                
-                std::string group_str = groups_str.substr(group_start, group_end - group_start);
-                if (!group_str.empty()) {
-                    crop_op->params.one_of_groups.push_back(std::stol(group_str));
+            std::vector<size_t> candidates;
+            bool in_row_order = false;
+            bool all_rows = false;
+            if (postings_rows < spatial_rows) {
+                std::cout << "Access path: postings-first (about " << postings_rows << " rows, spatial about "
+                          << spatial_rows << ")" << std::endl;
+                step_start = QueryProfiler::Clock::now();
+                postings.candidates(store, tree, tree.root(), candidates);
+                profiler_.addStep("postings_crop", QueryProfiler::elapsedMs(step_start));
+            } else if (options_.index != "none") {
+                // Only points inside the plan's bounding rectangle can match
+                std::cout << "Access path: spatial-first" << std::endl;
+                candidates = indexCandidates(store, bounds);
+            } else if (page.has_limit && store.sortedByYX()) {
+                // Rows are already in output order, so the predicate walks
+                // them from the cursor and stops once the page is full
+                std::cout << "Access path: (y, x) ordered scan until the page is full" << std::endl;
+                all_rows = true;
+                in_row_order = true;
+            } else {
+                // Vectorized rectangle test over every row, one morsel per task
+                CropKernel::Filter filter;
+                filter.region = bounds;
+                if (options_.columns == "double") {
+                    std::cout << "Access path: full scan with the " << CropKernel::best().name << " crop kernel on "
+                              << executor.threads() << " threads" << std::endl;
+                    step_start = QueryProfiler::Clock::now();
+                    candidates = executor.select(store.size(), [&store, &filter](size_t begin, size_t end, size_t* out) {
+                        size_t kept = CropKernel::select(store.xs().data() + begin, store.ys().data() + begin,
+                                                         store.categories().data() + begin, end - begin, filter, out);
+                        for (size_t i = 0; i < kept; ++i) out[i] += begin;
+                        return kept;
+                    });
+                } else {
+                    candidates.resize(store.size());
+                    step_start = QueryProfiler::Clock::now();
+                    QuantizedColumns compact(store, options_.columns == "float32" ? QuantizedColumns::Encoding::Float32
+                                                                                  : QuantizedColumns::Encoding::Fixed32);
+                    profiler_.addStep("compact_build", QueryProfiler::elapsedMs(step_start));
+                    std::cout << "Access path: full scan over " << compact.name() << " columns" << std::endl;
+                    step_start = QueryProfiler::Clock::now();
+                    candidates.resize(compact.select(filter, candidates.data()));
                 }
-                
-                group_start = group_end + 1;
+                profiler_.addStep("crop_kernel", QueryProfiler::elapsedMs(step_start));
+                in_row_order = true;
+            }
+            
+            if (!in_row_order) {
+                step_start = QueryProfiler::Clock::now();
+                sortCandidates(candidates);
+                profiler_.addStep("candidate_sort", QueryProfiler::elapsedMs(step_start));
+            }
+            if (!all_rows) {
+                std::cout << "Narrowed the scan to " << candidates.size() << " of " << store.size()
+                          << " regions" << std::endl;
+            }
+            
+            step_start = QueryProfiler::Clock::now();
+            if (tree.aggregate() == Aggregate::Count) {
+                matched = predicate.count(candidates, executor);
+            } else if (page.active()) {
+                rows = pageRows(store, predicate, all_rows ? nullptr : &candidates, page, executor);
+            } else {
+                rows = predicate.filter(candidates, executor);
             }
+            profiler_.addStep("scan", QueryProfiler::elapsedMs(step_start));
         }
         
-        // Extract proper flag if present
-        size_t proper_pos = content.find("\"proper\":", pos);
-        if (proper_pos != std::string::npos && proper_pos < content.find("}", pos)) {
-            size_t start = proper_pos + 9; // length of "\"proper\":"
-            std::string proper_str = content.substr(start, 4); // "true" or "fals"
-            crop_op->params.proper = (proper_str.find("true") != std::string::npos);
+        if (tree.aggregate() != Aggregate::None) {
+            step_start = QueryProfiler::Clock::now();
+            if (tree.aggregate() == Aggregate::Count) {
+                *counts = {{0, static_cast<long>(matched)}};
+            } else {
+                *counts = countRows(store, rows, tree.aggregate());
+                matched = rows.size();
+            }
+            profiler_.addStep("aggregate", QueryProfiler::elapsedMs(step_start));
+            profiler_.endNode(trace, counts->size());
+            std::cout << "Counted " << matched << " matching points" << std::endl;
+            return {};
         }
         
-        return crop_op;
+        step_start = QueryProfiler::Clock::now();
+        std::vector<InspectionPoint> points;
+        for (size_t row : rows) {
+            InspectionPoint point;
+            point.id = store.ids()[row];
+            point.group_id = store.groupIds()[row];
+            point.x = store.xs()[row];
+            point.y = store.ys()[row];
+            point.category = store.categories()[row];
+            points.push_back(point);
+        }
+        profiler_.addStep("materialize", QueryProfiler::elapsedMs(step_start));
+        profiler_.endNode(trace, points.size());
+        
+        // The filter keeps row order, and a page is selected in (y, x) order
+        ordered = store.sortedByYX() || page.active();
+        
+        std::cout << "Found " << points.size() << " points" << std::endl;
+        return points;
     }
     
-    static std::shared_ptr<AndOperation> parseAndOperation(const std::string& content, size_t start_pos) {
-        auto and_op = std::make_shared<AndOperation>();
+    // Matching rows of the requested page, in (y, x) order. candidates are
+    // ascending rows, or every row of the store when null. On a (y, x) sorted
+    // store the rows after the cursor are filtered in growing slices until
+    // offset + limit have matched; otherwise every match after the cursor is
+    // kept and only the first offset + limit are ordered, with a partial sort.
+    // Ties in (y, x) are ordered by id, like the SQL engine's pages.
+    std::vector<size_t> pageRows(const RegionStore& store, const CompiledPredicate& predicate,
+                                 const std::vector<size_t>* candidates, const ResultPage& page,
+                                 const MorselExecutor& executor) {
+        const auto& xs = store.xs();
+        const auto& ys = store.ys();
+        const auto& ids = store.ids();
+        size_t count = candidates ? candidates->size() : store.size();
+        auto row = [candidates](size_t i) { return candidates ? (*candidates)[i] : i; };
+        size_t wanted = !page.has_limit ? SIZE_MAX
+                      : page.limit > SIZE_MAX - page.offset ? SIZE_MAX : page.offset + page.limit;
         
-        size_t array_start = content.find("[", start_pos);
-        size_t array_end = content.find("]", array_start);
-        size_t pos = array_start + 1;
-        
-        while (pos < array_end) {
-            // Skip whitespace and commas
-            while (pos < array_end && (content[pos] == ' ' || content[pos] == ',' || content[pos] == '\n')) {
-                pos++;
+        std::vector<size_t> rows;
+        if (store.sortedByYX()) {
+            // First candidate after the cursor
+            size_t low = 0;
+            size_t high = count;
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+                if (page.isAfter(xs[row(mid)], ys[row(mid)])) {
+                    high = mid;
+                } else {
+                    low = mid + 1;
+                }
             }
-            if (pos >= array_end) break;
             
-            // Parse nested operation
-            if (content[pos] == '{') {
-                and_op->operands.push_back(parseOperation(content, pos));
-                // Move position past this object
-                pos = findMatchingBrace(content, pos) + 1;
+            size_t slice = std::max<size_t>(executor.morselSize(), wanted > count / 2 ? count : 2 * wanted);
+            std::vector<size_t> part;
+            for (size_t begin = low; begin < count && rows.size() < wanted; begin += slice, slice *= 2) {
+                size_t end = begin + std::min(slice, count - begin);
+                part.clear();
+                for (size_t i = begin; i < end; ++i) part.push_back(row(i));
+                part = predicate.filter(part, executor);
+                rows.insert(rows.end(), part.begin(), part.end());
+            }
+        } else {
+            if (candidates) {
+                rows = predicate.filter(*candidates, executor);
+            } else {
+                rows = predicate.scan(executor);
+            }
+            rows.erase(std::remove_if(rows.begin(), rows.end(), [&](size_t r) { return !page.isAfter(xs[r], ys[r]); }),
+                       rows.end());
+            auto before = [&](size_t a, size_t b) {
+                return RegionStore::yxIdBefore(xs[a], ys[a], ids[a], xs[b], ys[b], ids[b]);
+            };
+            if (wanted < rows.size()) {
+                std::partial_sort(rows.begin(), rows.begin() + wanted, rows.end(), before);
+                rows.resize(wanted);
+            } else {
+                std::sort(rows.begin(), rows.end(), before);
             }
         }
         
-        return and_op;
+        rows.erase(rows.begin(), rows.begin() + std::min(page.offset, rows.size()));
+        if (page.has_limit && rows.size() > page.limit) {
+            rows.resize(page.limit);
+        }
+        std::cout << "Selected a page of " << rows.size() << " rows" << std::endl;
+        return rows;
     }
     
-    static std::shared_ptr<OrOperation> parseOrOperation(const std::string& content, size_t start_pos) {
-        auto or_op = std::make_shared<OrOperation>();
+    // Points per category, in category order, or the number of distinct groups
+    // as the popcount of a bitmap over the store's dense group indices
+    static std::vector<AggregateRow> countRows(const RegionStore& store, const std::vector<size_t>& rows,
+                                               Aggregate aggregate) {
+        if (aggregate == Aggregate::CountGroups) {
+            std::vector<uint64_t> groups((store.groupCount() + 63) / 64, 0);
+            for (size_t row : rows) {
+                uint32_t group = store.groupIndices()[row];
+                groups[group >> 6] |= uint64_t(1) << (group & 63);
+            }
+            long distinct = 0;
+            for (uint64_t word : groups) distinct += __builtin_popcountll(word);
+            return {{0, distinct}};
+        }
         
-        size_t array_start = content.find("[", start_pos);
-        size_t array_end = content.find("]", array_start);
-        size_t pos = array_start + 1;
+        std::unordered_map<int, long> by_category;
+        for (size_t row : rows) ++by_category[store.categories()[row]];
+        std::vector<AggregateRow> counts;
+        for (const auto& entry : by_category) counts.push_back({entry.first, entry.second});
+        std::sort(counts.begin(), counts.end(), [](const AggregateRow& a, const AggregateRow& b) { return a.key < b.key; });
+        return counts;
+    }
+    
+    // Rows the spatial path tests: the whole store for a plain scan, otherwise
+    // the share of the store's extent covered by bounds, assuming even density,
+    // plus the cost of building the index unless a saved KD-tree is reused
+    double spatialEstimate(const RegionStore& store, const Region& bounds) const {
+        if (options_.index == "none" || store.size() == 0) {
+            return static_cast<double>(store.size());
+        }
+        double build = 0.0;
+        if (options_.index == "rtree") {
+            build = HilbertRTree::buildCost(store);
+        } else if (options_.index == "grid") {
+            build = GridIndex::buildCost(store);
+        } else if (!(snapshot_ && snapshot_->hasIndex()) &&
+                   (options_.index_file.empty() || !std::filesystem::exists(options_.index_file))) {
+            build = KdTree::buildCost(store);
+        }
         
-        while (pos < array_end) {
-            // Skip whitespace and commas
-            while (pos < array_end && (content[pos] == ' ' || content[pos] == ',' || content[pos] == '\n')) {
-                pos++;
+        const RegionStore::GroupBounds& all = store.extent();
+        double width = std::min(bounds.p_max_x, all.max_x) - std::max(bounds.p_min_x, all.min_x);
+        double height = std::min(bounds.p_max_y, all.max_y) - std::max(bounds.p_min_y, all.min_y);
+        double extent = (all.max_x - all.min_x) * (all.max_y - all.min_y);
+        if (width < 0.0 || height < 0.0) return build;
+        if (extent <= 0.0) return build + store.size();
+        return build + store.size() * std::min(1.0, width * height / extent);
+    }
+    
+    // Sorts candidate rows and drops duplicates. Candidates made of a few
+    // ascending runs, one per postings list when the store is (y, x) sorted,
+    // are merged in one pass over a heap of run heads instead.
+    static void sortCandidates(std::vector<size_t>& candidates) {
+        std::vector<std::pair<size_t, size_t>> runs;   // [begin, end) of each ascending run
+        size_t run_begin = 0;
+        for (size_t i = 1; i <= candidates.size() && runs.size() <= MAX_MERGE_RUNS; ++i) {
+            if (i == candidates.size() || candidates[i] < candidates[i - 1]) {
+                runs.push_back({run_begin, i});
+                run_begin = i;
             }
-            if (pos >= array_end) break;
-            
-            // Parse nested operation
-            if (content[pos] == '{') {
-                or_op->operands.push_back(parseOperation(content, pos));
-                // Move position past this object
-                pos = findMatchingBrace(content, pos) + 1;
+        }
+        
+        if (runs.size() > MAX_MERGE_RUNS) {
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            return;
+        }
+        if (runs.size() <= 1) {
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            return;
+        }
+        
+        using Head = std::pair<size_t, size_t>;   // (row, run)
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+        for (size_t run = 0; run < runs.size(); ++run) {
+            heads.push({candidates[runs[run].first], run});
+        }
+        std::vector<size_t> merged;
+        merged.reserve(candidates.size());
+        while (!heads.empty()) {
+            auto [row, run] = heads.top();
+            heads.pop();
+            if (merged.empty() || merged.back() != row) merged.push_back(row);
+            if (++runs[run].first < runs[run].second) heads.push({candidates[runs[run].first], run});
+        }
+        candidates.swap(merged);
+    }
+    
+    static bool hasPostingsFilter(const QueryTree& tree) {
+        // Only nodes reachable from the root: the arena still holds the ones
+        // the optimizer rewrote away
+        std::vector<bool> seen(tree.size(), false);
+        std::vector<NodeId> pending = {tree.root()};
+        while (!pending.empty()) {
+            NodeId id = pending.back();
+            pending.pop_back();
+            if (seen[id]) {
+                continue;
+            }
+            seen[id] = true;
+            bool filtered = std::visit(Overloaded{
+                [&](const CropNode& crop) {
+                    return crop.params.has_category || QueryOptimizer::hasGroupFilter(crop.params);
+                },
+                [&](const AndNode& node) {
+                    for (NodeId operand : tree.operands(node.operands)) pending.push_back(operand);
+                    return false;
+                },
+                [&](const OrNode& node) {
+                    for (NodeId operand : tree.operands(node.operands)) pending.push_back(operand);
+                    return false;
+                },
+                [&](const EmptyNode&) { return false; },
+            }, tree.node(id));
+            if (filtered) {
+                return true;
             }
         }
+        return false;
+    }
+    
+    // Store rows inside bounds, found through the index chosen with --index
+    std::vector<size_t> indexCandidates(const RegionStore& store, const Region& bounds) {
+        if (options_.index == "rtree") {
+            auto step_start = QueryProfiler::Clock::now();
+            HilbertRTree index(store);
+            profiler_.addStep("index_build", QueryProfiler::elapsedMs(step_start));
+            std::cout << "Built Hilbert R-tree index: " << index.nodeCount() << " nodes, height "
+                      << index.height() << std::endl;
+            
+            step_start = QueryProfiler::Clock::now();
+            std::vector<size_t> candidates = index.crop(bounds);
+            profiler_.addStep("index_crop", QueryProfiler::elapsedMs(step_start));
+            return candidates;
+        }
         
-        return or_op;
+        if (options_.index == "grid") {
+            auto step_start = QueryProfiler::Clock::now();
+            GridIndex index(store);
+            profiler_.addStep("index_build", QueryProfiler::elapsedMs(step_start));
+            std::cout << "Built grid index: " << index.columns() << "x" << index.rows() << " cells" << std::endl;
+            
+            step_start = QueryProfiler::Clock::now();
+            std::vector<size_t> candidates = index.crop(bounds);
+            profiler_.addStep("index_crop", QueryProfiler::elapsedMs(step_start));
+            return candidates;
+        }
+        
+        KdTree index = loadKdTree(store);
+        auto step_start = QueryProfiler::Clock::now();
+        std::vector<size_t> candidates = index.crop(bounds);
+        profiler_.addStep("index_crop", QueryProfiler::elapsedMs(step_start));
+        return candidates;
     }
     
-    static double extractDouble(const std::string& content, const std::string& key, size_t& pos) {
-        size_t found = content.find(key, pos);
-        if (found == std::string::npos) return 0.0;
+    // Reuses the snapshot's or the saved index when it was built from the same
+    // regions, otherwise builds and saves it
+    KdTree loadKdTree(const RegionStore& store) {
+        auto step_start = QueryProfiler::Clock::now();
+        if (snapshot_ && snapshot_->hasIndex()) {
+            KdTree index = snapshot_->index();
+            profiler_.addStep("index_load", QueryProfiler::elapsedMs(step_start));
+            std::cout << "Loaded KD-tree index from snapshot" << std::endl;
+            return index;
+        }
+        if (!options_.index_file.empty() && std::filesystem::exists(options_.index_file)) {
+            try {
+                KdTree index = KdTree::load(options_.index_file, store);
+                profiler_.addStep("index_load", QueryProfiler::elapsedMs(step_start));
+                std::cout << "Loaded KD-tree index from: " << options_.index_file << std::endl;
+                return index;
+            } catch (const std::exception& e) {
+                std::cout << "Rebuilding index: " << e.what() << std::endl;
+            }
+        }
         
-        size_t start = found + key.length();
-        size_t end = content.find_first_of(",}", start);
-        std::string num_str = content.substr(start, end - start);
-        pos = end;
+        step_start = QueryProfiler::Clock::now();
+        KdTree index(store);
+        profiler_.addStep("index_build", QueryProfiler::elapsedMs(step_start));
+        std::cout << "Built KD-tree index: " << index.nodeCount() << " nodes, "
+                  << index.levels() << " levels" << std::endl;
         
-        return std::stod(num_str);
+        if (!options_.index_file.empty()) {
+            index.save(options_.index_file);
+        }
+        return index;
     }
     
-    static size_t findMatchingBrace(const std::string& content, size_t start) {
-        int brace_count = 0;
-        for (size_t i = start; i < content.length(); ++i) {
-            if (content[i] == '{') brace_count++;
-            else if (content[i] == '}') brace_count--;
-            
-            if (brace_count == 0) return i;
+    // Maps the snapshot written by the loader; its columns are used in place
+    void openSnapshot() {
+        auto step_start = QueryProfiler::Clock::now();
+        snapshot_ = std::make_unique<RegionSnapshot>(options_.snapshot_file);
+        profiler_.addStep("snapshot_map", QueryProfiler::elapsedMs(step_start));
+        if (options_.verify_snapshot) {
+            step_start = QueryProfiler::Clock::now();
+            snapshot_->verify();
+            profiler_.addStep("snapshot_verify", QueryProfiler::elapsedMs(step_start));
         }
-        return std::string::npos;
+        
+        const RegionStore& store = snapshot_->store();
+        std::cout << "Mapped " << store.size() << " regions in " << store.groupCount() << " groups"
+                  << (store.sortedByYX() ? ", sorted by (y, x)," : "") << " from: " << options_.snapshot_file << std::endl;
     }
-};
+    
+    RegionStore loadRegionStore() {
+        auto step_start = QueryProfiler::Clock::now();
+        pqxx::connection conn(connection_string_);
+        pqxx::work txn(conn);
+        profiler_.addStep("connect", QueryProfiler::elapsedMs(step_start));
+        
+        std::string query = "SELECT id, group_id, coord_x, coord_y, category FROM inspection_region";
+        if (options_.layout == "yx") {
+            query += " ORDER BY coord_y, coord_x, id";
+        }
+        step_start = QueryProfiler::Clock::now();
+        auto result = txn.exec(query);
+        double sql_ms = QueryProfiler::elapsedMs(step_start);
+        profiler_.addStep("sql", sql_ms);
+        profiler_.addStatement(query, sql_ms, explainStatement(txn, query));
+        
+        step_start = QueryProfiler::Clock::now();
+        RegionStore store;
+        store.reserve(result.size());
+        
+        for (size_t i = 0; i < result.size(); ++i) {
+            store.append(result[i]["id"].as<long>(),
+                         result[i]["group_id"].as<long>(),
+                         result[i]["coord_x"].as<double>(),
+                         result[i]["coord_y"].as<double>(),
+                         result[i]["category"].as<int>());
+        }
+        profiler_.addStep("decode", QueryProfiler::elapsedMs(step_start));
+        
+        std::cout << "Loaded " << store.size() << " regions in " << store.groupCount() << " groups"
+                  << (store.sortedByYX() ? ", sorted by (y, x)" : "") << std::endl;
+        return store;
+    }
+    
+    // page is applied by the statement producing this node's points (the
+    // root's). AND / OR nodes wait on a stack of frames while their operands
+    // run, folding each operand's points into an id set, so nesting depth is
+    // not bounded by the call stack.
+    std::vector<InspectionPoint> executeOperation(const QueryTree& tree, NodeId id,
+                                                  const ResultPage& page = ResultPage()) {
+        struct Frame {
+            NodeId id;
+            bool is_and;
+            QueryTree::Operands operands;
+            ResultPage page;
+            size_t trace;
+            size_t next = 0;          // operand to run next
+            std::set<long> ids;       // selected by the operands run so far
+        };
+        std::vector<Frame> frames;
+        std::vector<InspectionPoint> points;   // of the node finished last
+        NodeId current = id;
+        while (true) {
+            // Start current: a cached node, crop or empty node finishes at
+            // once, an AND / OR with operands pushes a frame
+            bool pushed = false;
+            auto cached = memo_.find(current);
+            if (cached != memo_.end()) {
+                ++cache_hits_;
+                size_t trace = profiler_.beginNode(current, nodeType(tree, current), QueryOptimizer::label(tree, current));
+                profiler_.endNode(trace, cached->second.size(), true);
+                points = cached->second;
+            } else {
+                ++evaluations_;
+                size_t trace = profiler_.beginNode(current, nodeType(tree, current), QueryOptimizer::label(tree, current));
+                ResultPage current_page = frames.empty() ? page : ResultPage();
+                auto push = [&](bool is_and, QueryTree::Operands operands) {
+                    if (operands.empty()) {
+                        points.clear();
+                        return false;
+                    }
+                    frames.push_back({current, is_and, operands, current_page, trace, 0, {}});
+                    return true;
+                };
+                pushed = std::visit(Overloaded{
+                    [&](const CropNode& crop) {
+                        points = cropPoints(current, crop.params, current_page);
+                        return false;
+                    },
+                    [&](const AndNode& node) { return push(true, tree.operands(node.operands)); },
+                    [&](const OrNode& node) { return push(false, tree.operands(node.operands)); },
+                    [&](const EmptyNode&) {
+                        points.clear();
+                        return false;
+                    },
+                }, tree.node(current));
+                if (!pushed) {
+                    finishNode(current, trace, points);
+                }
+            }
 
-struct InspectionPoint {
-    long id;
-    long group_id;
-    double x;
-    double y;
-    int category;
+            // Fold finished nodes into their operators until one has an
+            // operand left to run; an AND stops once its ids run out
+            if (!pushed) {
+                while (true) {
+                    if (frames.empty()) {
+                        return points;
+                    }
+                    Frame& frame = frames.back();
+                    addOperand(frame.is_and, frame.next == 1, points, frame.ids);
+                    if (frame.next < frame.operands.size() && !(frame.is_and && frame.ids.empty())) {
+                        break;
+                    }
+                    points = getPointsByIds(frame.ids, frame.page);
+                    finishNode(frame.id, frame.trace, points);
+                    frames.pop_back();
+                }
+            }
+            Frame& frame = frames.back();
+            current = frame.operands[frame.next++];
+        }
+    }
     
-    // For sorting: by y then x
-    bool operator<(const InspectionPoint& other) const {
-        if (y < other.y) return true;
-        if (y > other.y) return false;
-        return x < other.x;
+    // Points of a crop leaf, taken from the pipeline when it fetched them ahead
+    std::vector<InspectionPoint> cropPoints(NodeId id, const CropParams& params, const ResultPage& page) {
+        auto prefetched = prefetched_.find(id);
+        if (prefetched == prefetched_.end()) {
+            return executeCropOperation(params, page);
+        }
+        auto points = std::move(prefetched->second);
+        prefetched_.erase(prefetched);
+        profiler_.addRowsIn(points.size());
+        return points;
     }
     
-    // For set operations
-    bool operator==(const InspectionPoint& other) const {
-        return id == other.id;
+    // Closes a node's trace entry and keeps its points when several parents share it
+    void finishNode(NodeId id, size_t trace, const std::vector<InspectionPoint>& points) {
+        profiler_.endNode(trace, points.size());
+        if (id < shared_nodes_.size() && shared_nodes_[id]) {
+            memo_.emplace(id, points);
+        }
     }
-};
-
-// Hash function for InspectionPoint (for set operations)
-struct InspectionPointHash {
-    std::size_t operator()(const InspectionPoint& p) const {
-        return std::hash<long>()(p.id);
+    
+    static std::string nodeType(const QueryTree& tree, NodeId id) {
+        return std::visit(Overloaded{
+            [](const CropNode&) { return "CROP"; },
+            [](const AndNode&) { return "AND"; },
+            [](const OrNode&) { return "OR"; },
+            [](const EmptyNode&) { return "EMPTY"; },
+        }, tree.node(id));
     }
-};
-
-class RegionQuery {
-private:
-    std::string connection_string_;
     
-public:
-    RegionQuery(const std::string& conn_str) : connection_string_(conn_str) {}
+    std::vector<InspectionPoint> executeCropOperation(const CropParams& params, const ResultPage& page) {
+        std::string groups;
+        std::string query = buildCropQuery(params, &groups) + pageClause(page, "ir.");
+        std::cout << "Executing crop query: " << query << std::endl;
+        
+        auto points = fetchPoints(query, groups);
+        profiler_.addRowsIn(points.size());
+        
+        std::cout << "Found " << points.size() << " points" << std::endl;
+        return points;
+    }
     
-    bool executeQuery(const std::string& query_file, const std::string& output_file) {
-        try {
-            // Parse JSON query
-            auto query_op = SimpleJsonParser::parseQueryFile(query_file);
-            
-            // Execute query against database
-            auto points = executeOperation(query_op);
-            
-            // Sort points by (y, x)
-            std::sort(points.begin(), points.end());
-            
-            // Write output file
-            return writeOutputFile(output_file, points);
-            
-        } catch (const std::exception& e) {
-            std::cerr << "Error executing query: " << e.what() << std::endl;
-            return false;
+    // Reads the extent of the Hilbert curve the loader keyed the rows on
+    // (--cluster hilbert), leaving curve_ empty for an unclustered table or
+    // when inspection_region has no spatial_key column to filter on
+    void loadCurve() {
+        curve_.reset();
+        if (!options_.key_ranges) {
+            return;
+        }
+        auto step_start = QueryProfiler::Clock::now();
+        pqxx::connection conn(connection_string_);
+        pqxx::work txn(conn);
+        auto exists = txn.exec("SELECT to_regclass('inspection_region_curve') IS NOT NULL AND EXISTS ("
+                               "SELECT 1 FROM pg_attribute WHERE attrelid = to_regclass('inspection_region') "
+                               "AND attname = 'spatial_key' AND NOT attisdropped) AS clustered");
+        if (exists[0]["clustered"].as<bool>()) {
+            auto extent = txn.exec("SELECT min_x, min_y, max_x, max_y FROM inspection_region_curve");
+            if (extent.size() == 1) {
+                curve_ = std::make_unique<HilbertKey>(extent[0]["min_x"].as<double>(), extent[0]["min_y"].as<double>(),
+                                                      extent[0]["max_x"].as<double>(), extent[0]["max_y"].as<double>());
+            }
+        }
+        profiler_.addStep("curve", QueryProfiler::elapsedMs(step_start));
+        if (curve_) {
+            std::cout << "Table is clustered by Hilbert key, crops use key ranges" << std::endl;
         }
     }
     
-private:
-    std::vector<InspectionPoint> executeOperation(const std::shared_ptr<SimpleJsonParser::QueryOperation>& op) {
-        if (auto crop_op = std::dynamic_pointer_cast<SimpleJsonParser::CropOperation>(op)) {
-            return executeCropOperation(*crop_op);
-        } else if (auto and_op = std::dynamic_pointer_cast<SimpleJsonParser::AndOperation>(op)) {
-            return executeAndOperation(*and_op);
-        } else if (auto or_op = std::dynamic_pointer_cast<SimpleJsonParser::OrOperation>(op)) {
-            return executeOrOperation(*or_op);
-        } else {
-            throw std::runtime_error("Unknown operation type");
+    // Runs a SELECT, recording connect / sql time and the plan when profiling.
+    // A non-empty array is bound as the statement's $1 (see sqlArray).
+    pqxx::result runStatement(const std::string& query, const std::string& array = "") {
+        auto step_start = QueryProfiler::Clock::now();
+        pqxx::connection conn(connection_string_);
+        pqxx::work txn(conn);
+        profiler_.addStep("connect", QueryProfiler::elapsedMs(step_start));
+        
+        step_start = QueryProfiler::Clock::now();
+        auto result = array.empty() ? txn.exec(query) : txn.exec_params(query, array);
+        double sql_ms = QueryProfiler::elapsedMs(step_start);
+        profiler_.addStep("sql", sql_ms);
+        profiler_.addStatement(query, sql_ms, explainStatement(txn, query, array));
+        return result;
+    }
+    
+    // Runs a SELECT returning inspection_region rows and decodes them
+    std::vector<InspectionPoint> fetchPoints(const std::string& query, const std::string& array = "") {
+        return decodePoints(runStatement(query, array));
+    }
+    
+    // Crop leaves below the root, each once, in operand order
+    static std::vector<NodeId> collectCropLeaves(const QueryTree& tree) {
+        std::vector<bool> seen(tree.size(), false);
+        std::vector<NodeId> leaves;
+        std::vector<NodeId> pending = {tree.root()};
+        while (!pending.empty()) {
+            NodeId id = pending.back();
+            pending.pop_back();
+            if (seen[id]) {
+                continue;
+            }
+            seen[id] = true;
+            if (std::holds_alternative<CropNode>(tree.node(id))) {
+                if (id != tree.root()) leaves.push_back(id);
+                continue;
+            }
+            auto operands = tree.children(id);
+            for (size_t i = operands.size(); i-- > 0;) pending.push_back(operands[i]);
         }
+        return leaves;
     }
     
-    std::vector<InspectionPoint> executeCropOperation(const SimpleJsonParser::CropOperation& op) {
+    // Sends the statements of every crop leaf below the root through one
+    // connection as a pqxx::pipeline: they are queued back to back and the
+    // results read as they arrive, so the leaves cost one connection and
+    // about one round trip instead of one of each per leaf. Operators then
+    // take the leaves' points from prefetched_. An AND whose first operands
+    // come back empty no longer skips the rest, which the saved round trips
+    // outweigh for the few leaves a query has.
+    void prefetchCropLeaves(const QueryTree& tree) {
+        std::vector<NodeId> leaves = collectCropLeaves(tree);
+        if (leaves.size() < 2) {
+            return;
+        }
+        
+        size_t trace = profiler_.beginNode(-1, "PIPELINE", std::to_string(leaves.size()) + " crop statements");
+        auto step_start = QueryProfiler::Clock::now();
         pqxx::connection conn(connection_string_);
         pqxx::work txn(conn);
+        profiler_.addStep("connect", QueryProfiler::elapsedMs(step_start));
         
-        std::string query = buildCropQuery(op.params);
-        std::cout << "Executing crop query: " << query << std::endl;
+        step_start = QueryProfiler::Clock::now();
+        std::vector<std::string> queries;
+        std::vector<pqxx::result> results;
+        {
+            pqxx::pipeline pipe(txn);
+            std::vector<pqxx::pipeline::query_id> ids;
+            for (NodeId leaf : leaves) {
+                queries.push_back(buildCropQuery(std::get<CropNode>(tree.node(leaf)).params));
+                std::cout << "Pipelining crop query: " << queries.back() << std::endl;
+                ids.push_back(pipe.insert(queries.back()));
+            }
+            for (auto id : ids) {
+                results.push_back(pipe.retrieve(id));
+            }
+            pipe.complete();
+        }
+        double sql_ms = QueryProfiler::elapsedMs(step_start);
+        profiler_.addStep("sql", sql_ms);
         
-        auto result = txn.exec(query);
+        // Pipelined statements have no time of their own; each gets an even share
+        size_t rows = 0;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            profiler_.addStatement(queries[i], sql_ms / leaves.size(), explainStatement(txn, queries[i]));
+            prefetched_[leaves[i]] = decodePoints(results[i]);
+            rows += results[i].size();
+        }
+        profiler_.addRowsIn(rows);
+        profiler_.endNode(trace, rows);
+        std::cout << "Fetched " << leaves.size() << " crop leaves through one pipeline" << std::endl;
+    }
+    
+    std::vector<InspectionPoint> decodePoints(const pqxx::result& result) {
+        auto step_start = QueryProfiler::Clock::now();
         std::vector<InspectionPoint> points;
         
         for (size_t i = 0; i < result.size(); ++i) {
@@ -291,94 +946,207 @@ private:
             point.category = result[i]["category"].as<int>();
             points.push_back(point);
         }
+        profiler_.addStep("decode", QueryProfiler::elapsedMs(step_start));
         
-        std::cout << "Found " << points.size() << " points" << std::endl;
         return points;
     }
     
-    std::vector<InspectionPoint> executeAndOperation(const SimpleJsonParser::AndOperation& op) {
-        if (op.operands.empty()) {
-            return {};
+    // Server-side plan with actual timings and buffer usage, as JSON. The
+    // statement runs a second time, after the measured run, and that time is
+    // left out of the node's wall time.
+    std::string explainStatement(pqxx::work& txn, const std::string& query, const std::string& array = "") {
+        if (!profiler_.enabled()) {
+            return "";
         }
-        
-        // Start with first operand
-        auto result_set = executeOperation(op.operands[0]);
+        auto explain_start = QueryProfiler::Clock::now();
+        std::string explain = "EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) " + query;
+        auto result = array.empty() ? txn.exec(explain) : txn.exec_params(explain, array);
+        profiler_.excludeTime(QueryProfiler::elapsedMs(explain_start));
+        return result.empty() ? "" : result[0][0].as<std::string>();
+    }
+    
+    // Ids of the points every operand selects
+    std::set<long> intersectOperands(const QueryTree& tree, QueryTree::Operands operands) {
+        // Stop once nothing is left
         std::set<long> result_ids;
-        for (const auto& point : result_set) {
-            result_ids.insert(point.id);
+        for (size_t i = 0; i < operands.size() && (i == 0 || !result_ids.empty()); ++i) {
+            addOperand(true, i == 0, executeOperation(tree, operands[i]), result_ids);
         }
-        
-        // Intersect with remaining operands
-        for (size_t i = 1; i < op.operands.size(); ++i) {
-            auto current_set = executeOperation(op.operands[i]);
+        return result_ids;
+    }
+    
+    // Ids of the points any operand selects
+    std::set<long> uniteOperands(const QueryTree& tree, QueryTree::Operands operands) {
+        std::set<long> result_ids;
+        for (NodeId operand : operands) {
+            addOperand(false, false, executeOperation(tree, operand), result_ids);
+        }
+        return result_ids;
+    }
+    
+    // Folds one operand's points into the ids of an AND (intersection, first
+    // for its first operand) or an OR (union)
+    void addOperand(bool is_and, bool first, const std::vector<InspectionPoint>& points, std::set<long>& ids) {
+        profiler_.addRowsIn(points.size());
+        auto step_start = QueryProfiler::Clock::now();
+        if (!is_and || first) {
+            for (const auto& point : points) {
+                ids.insert(point.id);
+            }
+        } else {
+            // Intersection: keep only IDs present in both sets
             std::set<long> current_ids;
-            for (const auto& point : current_set) {
+            for (const auto& point : points) {
                 current_ids.insert(point.id);
             }
-            
-            // Intersection: keep only IDs present in both sets
             std::set<long> new_result_ids;
-            for (long id : result_ids) {
+            for (long id : ids) {
                 if (current_ids.count(id)) {
                     new_result_ids.insert(id);
                 }
             }
-            result_ids = new_result_ids;
+            ids = std::move(new_result_ids);
         }
-        
-        // Convert back to points
-        return getPointsByIds(result_ids);
+        profiler_.addStep("set_algebra", QueryProfiler::elapsedMs(step_start));
     }
     
-    std::vector<InspectionPoint> executeOrOperation(const SimpleJsonParser::OrOperation& op) {
-        std::set<long> result_ids;
-        
-        // Union of all operands
-        for (const auto& operand : op.operands) {
-            auto current_set = executeOperation(operand);
-            for (const auto& point : current_set) {
-                result_ids.insert(point.id);
-            }
+    // Converts set algebra results back to points
+    std::vector<InspectionPoint> getPointsByIds(const std::set<long>& ids, const ResultPage& page) {
+        if (ids.empty()) {
+            return {};
         }
-        
-        // Convert back to points
-        return getPointsByIds(result_ids);
+        return fetchPoints(buildIdsQuery(ids) + pageClause(page, ""), sqlArray(ids));
     }
     
-    std::vector<InspectionPoint> getPointsByIds(const std::set<long>& ids) {
-        if (ids.empty()) {
-            return {};
+    // Id lists longer than this are joined as a set instead of probed one by one
+    static constexpr size_t UNNEST_MIN_IDS = 1000;
+    
+    // The ids are bound as one bigint[] ($1), so the statement text and its
+    // plan do not grow with the list. A short list is probed through the
+    // primary key with = ANY; a long one becomes an unnest subquery, which
+    // the planner can hash or merge against the table like any other set.
+    static std::string buildIdsQuery(const std::set<long>& ids) {
+        std::string query = "SELECT id, group_id, coord_x, coord_y, category FROM inspection_region WHERE ";
+        if (ids.size() < UNNEST_MIN_IDS) {
+            return query + "id = ANY($1::bigint[])";
         }
-        
-        pqxx::connection conn(connection_string_);
-        pqxx::work txn(conn);
-        
-        std::string query = "SELECT id, group_id, coord_x, coord_y, category FROM inspection_region WHERE id IN (";
-        bool first = true;
-        for (long id : ids) {
-            if (!first) query += ", ";
-            query += std::to_string(id);
-            first = false;
+        return query + "id IN (SELECT unnest($1::bigint[]))";
+    }
+    
+    // Array literal ("{1,2,3}") of the values, bound as a bigint[] parameter
+    template <typename Values>
+    static std::string sqlArray(const Values& values) {
+        std::string array = "{";
+        for (long value : values) {
+            if (array.size() > 1) array += ",";
+            array += std::to_string(value);
         }
-        query += ")";
-        
-        auto result = txn.exec(query);
-        std::vector<InspectionPoint> points;
+        return array + "}";
+    }
+    
+    // Aggregate over the root's points, computed by the server: the statement
+    // selecting them (the root crop's, or the id list of the root AND / OR)
+    // is wrapped in COUNT / GROUP BY, so only the counts are sent back. A
+    // plain count of an AND / OR is the size of its id set.
+    std::vector<AggregateRow> executeAggregateOperation(const QueryTree& tree) {
+        NodeId root = tree.root();
+        Aggregate aggregate = tree.aggregate();
+        ++evaluations_;
+        size_t trace = profiler_.beginNode(root, nodeType(tree, root), QueryOptimizer::label(tree, root));
         
-        for (size_t i = 0; i < result.size(); ++i) {
-            InspectionPoint point;
-            point.id = result[i]["id"].as<long>();
-            point.group_id = result[i]["group_id"].as<long>();
-            point.x = result[i]["coord_x"].as<double>();
-            point.y = result[i]["coord_y"].as<double>();
-            point.category = result[i]["category"].as<int>();
-            points.push_back(point);
+        std::string matches;
+        std::string array;
+        std::set<long> ids;
+        std::visit(Overloaded{
+            [&](const CropNode& crop) { matches = buildCropQuery(crop.params, &array); },
+            [&](const AndNode& node) { ids = intersectOperands(tree, tree.operands(node.operands)); },
+            [&](const OrNode& node) { ids = uniteOperands(tree, tree.operands(node.operands)); },
+            [&](const EmptyNode&) {},
+        }, tree.node(root));
+        if (matches.empty() && !ids.empty() && aggregate != Aggregate::Count) {
+            matches = buildIdsQuery(ids);
+            array = sqlArray(ids);
         }
         
-        return points;
+        std::vector<AggregateRow> counts;
+        if (!matches.empty()) {
+            std::string query = buildAggregateQuery(aggregate, matches);
+            std::cout << "Executing aggregate query: " << query << std::endl;
+            auto result = runStatement(query, array);
+            for (size_t i = 0; i < result.size(); ++i) {
+                counts.push_back({result[i]["key"].as<long>(), result[i]["n"].as<long>()});
+            }
+        } else if (aggregate != Aggregate::CountByCategory) {
+            counts.push_back({0, static_cast<long>(ids.size())});
+        }
+        profiler_.endNode(trace, counts.size());
+        return counts;
+    }
+    
+    static std::string buildAggregateQuery(Aggregate aggregate, const std::string& matches) {
+        if (aggregate == Aggregate::CountByCategory) {
+            return "SELECT category AS key, COUNT(*) AS n FROM (" + matches + ") matches "
+                   "GROUP BY category ORDER BY category";
+        }
+        if (aggregate == Aggregate::CountGroups) {
+            return "SELECT 0 AS key, COUNT(DISTINCT group_id) AS n FROM (" + matches + ") matches";
+        }
+        return "SELECT 0 AS key, COUNT(*) AS n FROM (" + matches + ") matches";
+    }
+    
+    // Keyset cursor, (y, x) order and LIMIT / OFFSET appended to a statement's
+    // WHERE clause; with the loader's inspection_region_yx_covering index on
+    // (coord_y, coord_x, id) the server stops after the page instead of
+    // sorting every match
+    static std::string pageClause(const ResultPage& page, const std::string& alias) {
+        if (!page.active()) {
+            return "";
+        }
+        std::string clause;
+        if (page.has_after) {
+            clause += " AND (" + alias + "coord_y, " + alias + "coord_x) > (" +
+                      sqlNumber(page.after_y) + ", " + sqlNumber(page.after_x) + ")";
+        }
+        clause += " ORDER BY " + alias + "coord_y, " + alias + "coord_x, " + alias + "id";
+        if (page.has_limit) {
+            clause += " LIMIT " + std::to_string(page.limit);
+        }
+        if (page.offset > 0) {
+            clause += " OFFSET " + std::to_string(page.offset);
+        }
+        return clause;
     }
     
-    std::string buildCropQuery(const SimpleJsonParser::CropParams& params) {
+    // The rectangle is widened by the 1e-6 std::to_string may round its bounds by,
+    // so the ranges hold every row the coordinate comparisons accept
+    static std::string keyRangeClause(const HilbertKey& curve, const Region& region) {
+        const double slack = 1e-6;
+        auto ranges = curve.ranges(region.p_min_x - slack, region.p_min_y - slack,
+                                   region.p_max_x + slack, region.p_max_y + slack);
+        if (ranges.empty()) {
+            return " AND FALSE";
+        }
+        std::string clause = " AND (";
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            if (i > 0) clause += " OR ";
+            clause += "ir.spatial_key BETWEEN " + std::to_string(ranges[i].first) + " AND " + std::to_string(ranges[i].second);
+        }
+        return clause + ")";
+    }
+    
+    // Round-trips the double, as the output file does, so a cursor copied from
+    // the last written point matches it exactly
+    static std::string sqlNumber(double value) {
+        std::ostringstream out;
+        out.precision(17);
+        out << value;
+        return out.str();
+    }
+    
+    // With groups, a one_of_groups filter binds its ids as $1 and the array
+    // goes to *groups; without (pipelined statements take no parameters) the
+    // array is inlined as a single literal
+    std::string buildCropQuery(const CropParams& params, std::string* groups = nullptr) {
         std::string query = 
             "SELECT ir.id, ir.group_id, ir.coord_x, ir.coord_y, ir.category "
             "FROM inspection_region ir ";
@@ -404,6 +1172,12 @@ private:
                  " AND ir.coord_y >= " + std::to_string(params.region.p_min_y) + 
                  " AND ir.coord_y <= " + std::to_string(params.region.p_max_y);
         
+        // On a clustered table the key ranges covering the rectangle let the
+        // BRIN index on spatial_key skip every block range outside them
+        if (curve_) {
+            query += keyRangeClause(*curve_, params.region);
+        }
+        
         // Add category filter if specified
         if (params.has_category) {
             query += " AND ir.category = " + std::to_string(params.category);
@@ -411,25 +1185,54 @@ private:
         
         // Add groups filter if specified
         if (params.has_one_of_groups && !params.one_of_groups.empty()) {
-            query += " AND ir.group_id IN (";
-            for (size_t i = 0; i < params.one_of_groups.size(); ++i) {
-                if (i > 0) query += ", ";
-                query += std::to_string(params.one_of_groups[i]);
+            if (groups) {
+                *groups = sqlArray(params.one_of_groups);
+                query += " AND ir.group_id = ANY($1::bigint[])";
+            } else {
+                query += " AND ir.group_id = ANY('" + sqlArray(params.one_of_groups) + "'::bigint[])";
             }
-            query += ")";
         }
         
         return query;
     }
     
+    // count_by_category writes "category count" lines in category order, the
+    // other aggregates a single line with the count
+    bool writeCounts(const std::string& output_file, Aggregate aggregate, const std::vector<AggregateRow>& counts) {
+        std::ofstream file(output_file);
+        if (!file.is_open()) {
+            std::cerr << "Cannot open output file: " << output_file << std::endl;
+            return false;
+        }
+        
+        for (const AggregateRow& row : counts) {
+            if (aggregate == Aggregate::CountByCategory) {
+                file << row.key << " ";
+            }
+            file << row.count << std::endl;
+        }
+        
+        std::cout << "Output written to: " << output_file << " with " << counts.size() << " counts" << std::endl;
+        return true;
+    }
+    
     bool writeOutputFile(const std::string& output_file, const std::vector<InspectionPoint>& points) {
+        if (options_.output_format == "columnar") {
+            ColumnarOutput::write(output_file, points, options_.output_fields);
+            std::cout << "Columnar output written to: " << output_file << " with " << points.size()
+                      << " points" << std::endl;
+            return true;
+        }
+        
         std::ofstream file(output_file);
         if (!file.is_open()) {
             std::cerr << "Cannot open output file: " << output_file << std::endl;
             return false;
         }
         
-        // Write points in format: x y
+        // Write points in format: x y, with every digit needed to read the double
+        // back, so the last point of a page can be passed as the next page's cursor
+        file.precision(17);
         for (size_t i = 0; i < points.size(); ++i) {
             file << points[i].x << " " << points[i].y << std::endl;
         }
@@ -442,6 +1245,8 @@ private:
 int main(int argc, char* argv[]) {
     std::string query_file;
     std::string output_file = "output.txt";
+    QueryOptions options;
+    std::string threads;
     
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
@@ -450,11 +1255,84 @@ int main(int argc, char* argv[]) {
             query_file = argv[++i];
         } else if (arg == "--output" && i + 1 < argc) {
             output_file = argv[++i];
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else if (arg == "--print-plan") {
+            options.print_plan = true;
+        } else if (arg == "--no-cse") {
+            options.share_subtrees = false;
+        } else if (arg == "--no-pipeline") {
+            options.pipeline = false;
+        } else if (arg == "--no-key-ranges") {
+            options.key_ranges = false;
+        } else if (arg == "--engine" && i + 1 < argc) {
+            options.engine = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc) {
+            options.profile_file = argv[++i];
+        } else if (arg == "--index" && i + 1 < argc) {
+            options.index = argv[++i];
+        } else if (arg == "--index-file" && i + 1 < argc) {
+            options.index_file = argv[++i];
+        } else if (arg == "--columns" && i + 1 < argc) {
+            options.columns = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = argv[++i];
+        } else if (arg == "--layout" && i + 1 < argc) {
+            options.layout = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            options.snapshot_file = argv[++i];
+        } else if (arg == "--verify-snapshot") {
+            options.verify_snapshot = true;
+        } else if (arg == "--output-format" && i + 1 < argc) {
+            options.output_format = argv[++i];
+        } else if (arg == "--output-fields" && i + 1 < argc) {
+            try {
+                options.output_fields = ColumnarOutput::parseFields(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
         }
     }
     
     if (query_file.empty()) {
-        std::cerr << "Usage: " << argv[0] << " --query <query_file.json> [--output <output_file.txt>]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " --query <query_file.json> [--output <output_file.txt>]"
+                  << " [--no-optimize] [--no-cse] [--no-pipeline] [--no-key-ranges] [--print-plan] [--engine sql|memory]"
+                  << " [--profile <trace.json>] [--index none|kdtree|rtree|grid] [--index-file <index.bin>]"
+                  << " [--columns double|float32|fixed32] [--layout table|yx] [--threads <n>]"
+                  << " [--snapshot <regions.snap>] [--verify-snapshot] [--output-format text|columnar]"
+                  << " [--output-fields x,y,id,group_id,category]" << std::endl;
+        return 1;
+    }
+    
+    if (options.engine != "sql" && options.engine != "memory") {
+        std::cerr << "Unknown engine: " << options.engine << std::endl;
+        return 1;
+    }
+    
+    if (options.index != "none" && options.index != "kdtree" && options.index != "rtree" &&
+        options.index != "grid") {
+        std::cerr << "Unknown index: " << options.index << std::endl;
+        return 1;
+    }
+    
+    if (options.columns != "double" && options.columns != "float32" && options.columns != "fixed32") {
+        std::cerr << "Unknown column encoding: " << options.columns << std::endl;
+        return 1;
+    }
+    
+    if (options.layout != "table" && options.layout != "yx") {
+        std::cerr << "Unknown layout: " << options.layout << std::endl;
+        return 1;
+    }
+    
+    if (options.output_format != "text" && options.output_format != "columnar") {
+        std::cerr << "Unknown output format: " << options.output_format << std::endl;
+        return 1;
+    }
+    
+    if (!threads.empty() && !parseCount(threads, options.threads)) {
+        std::cerr << "Invalid thread count: " << threads << std::endl;
         return 1;
     }
     
@@ -462,7 +1340,7 @@ int main(int argc, char* argv[]) {
     std::string connection_string = "dbname=inspection_db user=kyi host=localhost port=5432";
     
     try {
-        RegionQuery query(connection_string);
+        RegionQuery query(connection_string, options);
         
         if (query.executeQuery(query_file, output_file)) {
             std::cout << "Query executed successfully!" << std::endl;